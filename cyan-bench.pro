@@ -0,0 +1,42 @@
+# Cyan <https://github.com/olear/cyan>,
+# Copyright (C) 2016 Ole-André Rodlie <olear@fxarena.net>
+#
+# Cyan is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as published
+# by the Free Software Foundation.
+#
+# Cyan is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with Cyan.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+
+# Benchmark for the conversion engine, not installed
+# qmake cyan-bench.pro && make -f Makefile.bench && build/cyan-bench > bench.json
+
+QT += core gui
+greaterThan(QT_MAJOR_VERSION, 4): QT += concurrent
+CONFIG += console
+CONFIG -= app_bundle
+
+TARGET = cyan-bench
+VERSION = 1.0.0.RC2
+TEMPLATE = app
+# cyan.pro owns the Makefile in this folder
+MAKEFILE = Makefile.bench
+
+SOURCES += src/cyanbench.cpp src/cyanbatch.cpp src/cyanpipeline.cpp src/magenta.cpp src/magentatiff.cpp src/magentaprobe.cpp src/magentajpeg.cpp src/yellow.cpp src/black.cpp src/blacklut.cpp
+HEADERS  += src/cyanbatch.h src/cyanpipeline.h src/magenta.h src/magentatiff.h src/magentaprobe.h src/magentajpeg.h src/yellow.h src/black.h src/blacklut.h
+
+DESTDIR = build
+OBJECTS_DIR = $${DESTDIR}/.obj-bench
+MOC_DIR = $${DESTDIR}/.moc-bench
+
+DEFINES += CYAN_VERSION=\"\\\"$${VERSION}\\\"\"
+
+CONFIG += link_pkgconfig
+PKGCONFIG += Magick++ lcms2 libtiff-4 libjpeg
+
+LIBS += `pkg-config --libs --static Magick++`
@@ -14,14 +14,14 @@
 # along with Cyan.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
 
 QT += core gui
-greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets concurrent
 
 TARGET = cyan
 VERSION = 1.0.0.RC2
 TEMPLATE = app
 
-SOURCES += src/main.cpp src/cyan.cpp src/magenta.cpp src/yellow.cpp
-HEADERS  += src/cyan.h src/magenta.h src/yellow.h
+SOURCES += src/main.cpp src/cyan.cpp src/cyanbatch.cpp src/cyanpipeline.cpp src/magenta.cpp src/magentatiff.cpp src/magentaprobe.cpp src/magentajpeg.cpp src/yellow.cpp src/black.cpp src/blacklut.cpp
+HEADERS  += src/cyan.h src/cyanbatch.h src/cyanpipeline.h src/magenta.h src/magentatiff.h src/magentaprobe.h src/magentajpeg.h src/yellow.h src/black.h src/blacklut.h
 RESOURCES += res/cyan.qrc
 OTHER_FILES += res/cyan.spec
 
@@ -37,7 +37,7 @@ QMAKE_TARGET_DESCRIPTION = "Prepress viewer and converter"
 QMAKE_TARGET_COPYRIGHT = "Copyright (c)2016 Ole-André Rodlie <olear@fxarena.net>"
 
 CONFIG += link_pkgconfig
-PKGCONFIG += Magick++ lcms2
+PKGCONFIG += Magick++ lcms2 libtiff-4 libjpeg
 
 LIBS += `pkg-config --libs --static Magick++`
 
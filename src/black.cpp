@@ -0,0 +1,1084 @@
+/*
+* Cyan <https://github.com/olear/cyan>,
+* Copyright (C) 2016 Ole-André Rodlie
+*
+* Cyan is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License version 2 as published
+* by the Free Software Foundation.
+*
+* Cyan is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Cyan.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+*/
+
+#include "black.h"
+#include <QVector>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QCryptographicHash>
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
+#include <QSemaphore>
+#include <cstring>
+#include <cmath>
+
+#define BLACK_BAND_ROWS 16
+#define BLACK_LUT_PROBES 9
+
+// process-wide LRU cache of compiled transforms, most recently used last
+static QMutex blackCacheMutex;
+static QHash<QByteArray, blackTransform> blackCache;
+static QList<QByteArray> blackCacheOrder;
+static blackCacheStats blackCacheCounters = { 0, 0, 0, 0, 64*1024*1024, 0 };
+static bool blackLookupTables = true;
+
+static void blackCacheTrim()
+{
+    while (!blackCacheOrder.isEmpty() && blackCacheCounters.cost > blackCacheCounters.limit) {
+        blackTransform evicted = blackCache.take(blackCacheOrder.takeFirst());
+        if (evicted) {
+            blackCacheCounters.cost -= evicted->cost;
+        }
+        blackCacheCounters.evictions++;
+    }
+    blackCacheCounters.count = blackCache.size();
+}
+
+static blackTransform blackCacheFind(const QByteArray &key)
+{
+    QMutexLocker lock(&blackCacheMutex);
+    if (blackCache.contains(key)) {
+        blackCacheCounters.hits++;
+        blackCacheOrder.removeOne(key);
+        blackCacheOrder.append(key);
+        return blackCache.value(key);
+    }
+    blackCacheCounters.misses++;
+    return blackTransform();
+}
+
+static void blackCacheInsert(const QByteArray &key, blackTransform transform)
+{
+    QMutexLocker lock(&blackCacheMutex);
+    if (!blackCache.contains(key)) {
+        blackCache.insert(key, transform);
+        blackCacheOrder.append(key);
+        blackCacheCounters.cost += transform->cost;
+        blackCacheTrim();
+    }
+}
+
+// worker threads for row bands, the calling thread always converts one band itself
+static int blackThreadCount = qMax(1, QThread::idealThreadCount());
+
+static QThreadPool *blackCreatePool()
+{
+    QThreadPool *pool = new QThreadPool();
+    pool->setMaxThreadCount(qMax(1, blackThreadCount-1));
+    return pool;
+}
+
+static QThreadPool *blackPool()
+{
+    static QThreadPool *pool = blackCreatePool();
+    return pool;
+}
+
+class blackBand : public QRunnable
+{
+public:
+    blackBand(const blackTransformData *transform, const char *src, qint64 srcStride, char *dst, qint64 dstStride, int width, int rows, blackCancel cancel, QSemaphore *done)
+        : conversion(transform), input(src), inputStride(srcStride), output(dst), outputStride(dstStride), columns(width), count(rows), token(cancel), finished(done) {}
+    void run()
+    {
+        for (int y = 0; y < count; ++y) {
+            if (token.cancelled()) {
+                break;
+            }
+            if (conversion->lut) {
+                conversion->lut->apply(input+y*inputStride, output+y*outputStride, columns);
+            } else {
+                cmsDoTransform(conversion->handle, input+y*inputStride, output+y*outputStride, columns);
+            }
+        }
+        if (finished) {
+            finished->release();
+        }
+    }
+
+private:
+    const blackTransformData *conversion;
+    const char *input;
+    qint64 inputStride;
+    char *output;
+    qint64 outputStride;
+    int columns;
+    int count;
+    blackCancel token;
+    QSemaphore *finished;
+};
+
+// transform rows split in bands over the pool, transforms are created with cmsFLAGS_NOCACHE so sharing is safe
+static bool blackTransformRows(const blackTransformData *transform, const char *src, qint64 srcStride, char *dst, qint64 dstStride, int width, int rows, blackCancel cancel)
+{
+    int bands = qMin(blackThreadCount, qMax(1, rows/BLACK_BAND_ROWS));
+    int step = (rows+bands-1)/qMax(1, bands);
+    QSemaphore done;
+    int started = 0;
+    for (int y = step; y < rows; y += step) {
+        blackPool()->start(new blackBand(transform, src+y*srcStride, srcStride, dst+y*dstStride, dstStride, width, qMin(step, rows-y), cancel, &done));
+        started++;
+    }
+    blackBand first(transform, src, srcStride, dst, dstStride, width, qMin(step, rows), cancel, 0);
+    first.run();
+    done.acquire(started);
+    return !cancel.cancelled();
+}
+
+// converts its rows to CMYK one at a time and counts the ink sums, bands only
+// share the input so the histograms are added up once all are done. The rows go
+// through lcms even when the transform has a lookup table, the table is only
+// checked against a delta E and a small ink error moves pixels across the limit
+class blackCoverageBand : public QRunnable
+{
+public:
+    blackCoverageBand(const blackTransformData *transform, const char *src, qint64 srcStride, int width, int rows, blackCancel cancel, QSemaphore *done)
+        : histogram(4*BLACK_COVERAGE_STEPS+1, 0), conversion(transform), input(src), inputStride(srcStride), columns(width), count(rows), token(cancel), finished(done) {}
+    void run()
+    {
+        QByteArray ink(columns*4, 0);
+        qint64 *bins = histogram.data();
+        for (int y = 0; y < count; ++y) {
+            if (token.cancelled()) {
+                break;
+            }
+            cmsDoTransform(conversion->handle, input+y*inputStride, ink.data(), columns);
+            const uchar *cmyk = reinterpret_cast<const uchar*>(ink.constData());
+            for (int x = 0; x < columns; ++x, cmyk += 4) {
+                bins[cmyk[0]+cmyk[1]+cmyk[2]+cmyk[3]]++;
+            }
+        }
+        if (finished) {
+            finished->release();
+        }
+    }
+    QVector<qint64> histogram;
+
+private:
+    const blackTransformData *conversion;
+    const char *input;
+    qint64 inputStride;
+    int columns;
+    int count;
+    blackCancel token;
+    QSemaphore *finished;
+};
+
+bool blackImage::allocate()
+{
+    // sizes pixels for width, height, colorspace and depth, an image past
+    // BLACK_MAX_BYTES gets no pixels
+    if (width < 1 || height < 1 || depth < 8 || !fits()) {
+        pixels.clear();
+        return false;
+    }
+    pixels.resize((int)byteCount());
+    return true;
+}
+
+qint64 blackCoverage::pixels() const
+{
+    qint64 total = 0;
+    for (int i = 0; i < histogram.size(); ++i) {
+        total += histogram.at(i);
+    }
+    return total;
+}
+
+int blackCoverage::max() const
+{
+    for (int i = histogram.size()-1; i > 0; --i) {
+        if (histogram.at(i) > 0) {
+            return qRound(i*100.0/BLACK_COVERAGE_STEPS);
+        }
+    }
+    return 0;
+}
+
+double blackCoverage::mean() const
+{
+    qint64 total = 0;
+    double sum = 0;
+    for (int i = 0; i < histogram.size(); ++i) {
+        total += histogram.at(i);
+        sum += (double)i*histogram.at(i);
+    }
+    return total>0?sum*100.0/BLACK_COVERAGE_STEPS/total:0;
+}
+
+double blackCoverage::over(int limit) const
+{
+    // percent of the pixels above limit (in %)
+    qint64 total = 0;
+    qint64 above = 0;
+    int first = limit*BLACK_COVERAGE_STEPS/100+1;
+    for (int i = 0; i < histogram.size(); ++i) {
+        total += histogram.at(i);
+        if (i >= first) {
+            above += histogram.at(i);
+        }
+    }
+    return total>0?above*100.0/total:0;
+}
+
+// hands the precomputed gamut distances to lcms node by node, lcms samples in node order
+struct blackGamutNodes {
+    const cmsUInt16Number *values;
+    int next;
+};
+
+static cmsInt32Number blackGamutSampler(const cmsUInt16Number in[], cmsUInt16Number out[], void *cargo)
+{
+    Q_UNUSED(in)
+    blackGamutNodes *nodes = static_cast<blackGamutNodes*>(cargo);
+    out[0] = nodes->values[nodes->next++];
+    return TRUE;
+}
+
+Black::Black(QObject *parent) :
+    QObject(parent)
+{
+}
+
+Black::~Black()
+{
+}
+
+int Black::profileColorSpace(QByteArray profile)
+{
+    int status = 0;
+    if (profile.length() > 0) {
+        cmsHPROFILE lcmsProfile = cmsOpenProfileFromMem(profile.data(), profile.length());
+        if (lcmsProfile) {
+            status = colorSpace(cmsGetColorSpace(lcmsProfile));
+            cmsCloseProfile(lcmsProfile);
+        }
+    }
+    return status;
+}
+
+int Black::outputColorSpace(QByteArray profile)
+{
+    // a device link converts on its own, the output side is stored where other profiles keep the PCS
+    int status = 0;
+    if (profile.length() > 0) {
+        cmsHPROFILE lcmsProfile = cmsOpenProfileFromMem(profile.data(), profile.length());
+        if (lcmsProfile) {
+            if (cmsGetDeviceClass(lcmsProfile) == cmsSigLinkClass) {
+                status = colorSpace(cmsGetPCS(lcmsProfile));
+            } else {
+                status = colorSpace(cmsGetColorSpace(lcmsProfile));
+            }
+            cmsCloseProfile(lcmsProfile);
+        }
+    }
+    return status;
+}
+
+bool Black::isDeviceLink(QByteArray profile)
+{
+    bool status = false;
+    if (profile.length() > 0) {
+        cmsHPROFILE lcmsProfile = cmsOpenProfileFromMem(profile.data(), profile.length());
+        if (lcmsProfile) {
+            status = cmsGetDeviceClass(lcmsProfile) == cmsSigLinkClass;
+            cmsCloseProfile(lcmsProfile);
+        }
+    }
+    return status;
+}
+
+int Black::colorSpace(cmsColorSpaceSignature space)
+{
+    if (space == cmsSigRgbData) {
+        return 1;
+    } else if (space == cmsSigCmykData) {
+        return 2;
+    } else if (space == cmsSigGrayData) {
+        return 3;
+    }
+    return 0;
+}
+
+QByteArray Black::displayProfile()
+{
+    // built-in sRGB, used when the end of a preview chain is not RGB
+    static QByteArray srgb;
+    if (srgb.isEmpty()) {
+        cmsHPROFILE lcmsProfile = cmsCreate_sRGBProfile();
+        if (lcmsProfile) {
+            cmsUInt32Number length = 0;
+            if (cmsSaveProfileToMem(lcmsProfile, NULL, &length) && length > 0) {
+                QByteArray bytes((int)length, 0);
+                if (cmsSaveProfileToMem(lcmsProfile, bytes.data(), &length)) {
+                    srgb = bytes;
+                }
+            }
+            cmsCloseProfile(lcmsProfile);
+        }
+    }
+    return srgb;
+}
+
+cmsUInt32Number Black::pixelFormat(int colorspace, int depth)
+{
+    switch (colorspace) {
+    case 1:
+        return depth==16?TYPE_RGB_16:TYPE_RGB_8;
+    case 2:
+        return depth==16?TYPE_CMYK_16:TYPE_CMYK_8;
+    case 3:
+        return depth==16?TYPE_GRAY_16:TYPE_GRAY_8;
+    }
+    return 0;
+}
+
+cmsUInt32Number Black::renderingIntent(int intent)
+{
+    // same mapping as magentaAdjust/ImageMagick, undefined is perceptual
+    switch (intent) {
+    case 1:
+        return INTENT_SATURATION;
+    case 3:
+        return INTENT_ABSOLUTE_COLORIMETRIC;
+    }
+    return INTENT_PERCEPTUAL;
+}
+
+cmsHTRANSFORM Black::createTransform(QList<QByteArray> profiles, cmsUInt32Number inputFormat, cmsUInt32Number outputFormat, int intent, bool black, int proof)
+{
+    cmsHTRANSFORM transform = NULL;
+    if (profiles.size() < 1 || profiles.size() > 255 || inputFormat == 0 || outputFormat == 0) {
+        return transform;
+    }
+
+    QVector<cmsHPROFILE> lcmsProfiles;
+    for (int i = 0; i < profiles.size(); ++i) {
+        cmsHPROFILE lcmsProfile = cmsOpenProfileFromMem(profiles.at(i).data(), profiles.at(i).length());
+        if (!lcmsProfile) {
+            break;
+        }
+        lcmsProfiles.append(lcmsProfile);
+    }
+
+    if (lcmsProfiles.size() == profiles.size()) {
+        cmsUInt32Number flags = cmsFLAGS_NOCACHE;
+        if (black) {
+            flags |= cmsFLAGS_BLACKPOINTCOMPENSATION;
+        }
+        if (proof != BLACK_PROOF_NONE && lcmsProfiles.size() == 3) {
+            // input->proof with the selected intent, proof->display relative (absolute simulates the paper)
+            flags |= cmsFLAGS_SOFTPROOFING;
+            transform = cmsCreateProofingTransform(lcmsProfiles.at(0), inputFormat, lcmsProfiles.at(2), outputFormat, lcmsProfiles.at(1), renderingIntent(intent), intent==3?INTENT_ABSOLUTE_COLORIMETRIC:INTENT_RELATIVE_COLORIMETRIC, flags);
+        } else {
+            transform = cmsCreateMultiprofileTransform(lcmsProfiles.data(), lcmsProfiles.size(), inputFormat, outputFormat, renderingIntent(intent), flags);
+        }
+    }
+
+    for (int i = 0; i < lcmsProfiles.size(); ++i) {
+        cmsCloseProfile(lcmsProfiles.at(i));
+    }
+    return transform;
+}
+
+blackTransform Black::getTransform(QList<QByteArray> profiles, cmsUInt32Number inputFormat, cmsUInt32Number outputFormat, int intent, bool black, int proof)
+{
+    QByteArray key;
+    for (int i = 0; i < profiles.size(); ++i) {
+        key.append(profileHash(profiles.at(i)));
+    }
+    key.append(QByteArray::number(intent) + "|" + QByteArray::number(black) + "|" + QByteArray::number(inputFormat) + "|" + QByteArray::number(outputFormat) + "|" + QByteArray::number(proof));
+
+    bool useLut = lookupTables();
+    key.append(useLut?"|lut":"");
+    blackTransform cached = blackCacheFind(key);
+    if (cached) {
+        return cached;
+    }
+
+    cmsHTRANSFORM handle = createTransform(profiles, inputFormat, outputFormat, intent, black, proof);
+    if (!handle) {
+        return blackTransform();
+    }
+
+    // lcms does not report the size of a transform, estimate the precalculated CLUT
+    qint64 inputChannels = T_CHANNELS(inputFormat);
+    qint64 grid = inputChannels>4?7:(inputChannels==4?17:33);
+    qint64 cost = T_CHANNELS(outputFormat)*sizeof(cmsUInt16Number);
+    for (int i = 0; i < inputChannels; ++i) {
+        cost *= grid;
+    }
+    cost += 4096;
+    blackTransform transform(new blackTransformData(handle, cost));
+    // a table is checked in the colorspace of the last profile, which a device link does not describe
+    if (useLut && !isDeviceLink(profiles.last())) {
+        transform->lut = createLut(profiles, inputFormat, outputFormat, intent, black, proof);
+        if (transform->lut && !checkLut(transform->lut, handle, profiles.last(), inputFormat, outputFormat)) {
+            delete transform->lut;
+            transform->lut = 0;
+        }
+        if (transform->lut) {
+            transform->cost += transform->lut->nodes()*transform->lut->outputChannels()*sizeof(unsigned short);
+        }
+    }
+
+    blackCacheInsert(key, transform);
+    return transform;
+}
+
+QByteArray Black::profileHash(QByteArray profile)
+{
+    return QCryptographicHash::hash(profile, QCryptographicHash::Md5);
+}
+
+void Black::setThreads(int threads)
+{
+    blackThreadCount = qMax(1, threads>0?threads:QThread::idealThreadCount());
+    blackPool()->setMaxThreadCount(qMax(1, blackThreadCount-1));
+}
+
+int Black::threads()
+{
+    return blackThreadCount;
+}
+
+void Black::setCacheLimit(qint64 bytes)
+{
+    QMutexLocker lock(&blackCacheMutex);
+    blackCacheCounters.limit = bytes;
+    blackCacheTrim();
+}
+
+blackCacheStats Black::cacheStats()
+{
+    QMutexLocker lock(&blackCacheMutex);
+    return blackCacheCounters;
+}
+
+void Black::clearCache()
+{
+    QMutexLocker lock(&blackCacheMutex);
+    blackCache.clear();
+    blackCacheOrder.clear();
+    blackCacheCounters.cost = 0;
+    blackCacheCounters.count = 0;
+}
+
+void Black::setLookupTables(bool enabled)
+{
+    QMutexLocker lock(&blackCacheMutex);
+    blackLookupTables = enabled;
+}
+
+bool Black::lookupTables()
+{
+    QMutexLocker lock(&blackCacheMutex);
+    return blackLookupTables;
+}
+
+blackLut *Black::createLut(QList<QByteArray> profiles, cmsUInt32Number inputFormat, cmsUInt32Number outputFormat, int intent, bool black, int proof)
+{
+    // 8/16-bit RGB or CMYK to 8-bit RGB, CMYK or display BGRA, anything else stays in lcms
+    int inputs = 0;
+    switch (inputFormat) {
+    case TYPE_RGB_8:
+    case TYPE_RGB_16:
+        inputs = 3;
+        break;
+    case TYPE_CMYK_8:
+    case TYPE_CMYK_16:
+        inputs = 4;
+        break;
+    default:
+        return 0;
+    }
+    int depth = T_BYTES(inputFormat)*8;
+    int outputs = 0;
+    bool bgra = false;
+    cmsUInt32Number nodeFormat = 0;
+    switch (outputFormat) {
+    case TYPE_RGB_8:
+        outputs = 3;
+        nodeFormat = TYPE_RGB_16;
+        break;
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    case TYPE_BGRA_8:
+        outputs = 3;
+        bgra = true;
+        nodeFormat = TYPE_BGR_16;
+        break;
+#endif
+    case TYPE_CMYK_8:
+        outputs = 4;
+        nodeFormat = TYPE_CMYK_16;
+        break;
+    default:
+        return 0;
+    }
+
+    cmsHTRANSFORM sampler = createTransform(profiles, inputs==4?TYPE_CMYK_16:TYPE_RGB_16, nodeFormat, intent, black, proof);
+    if (!sampler) {
+        return 0;
+    }
+    blackLut *lut = new blackLut(inputs, depth, outputs, bgra, inputs==4?17:33);
+    int nodes = lut->nodes();
+    QVector<unsigned short> input(nodes*inputs);
+    QVector<unsigned short> output(nodes*outputs);
+    for (int i = 0; i < nodes; ++i) {
+        lut->nodeInput(i, input.data()+i*inputs);
+    }
+    cmsDoTransform(sampler, input.constData(), output.data(), nodes);
+    cmsDeleteTransform(sampler);
+    for (int i = 0; i < nodes; ++i) {
+        lut->setNode(i, output.constData()+i*outputs);
+    }
+    return lut;
+}
+
+bool Black::checkLut(const blackLut *lut, cmsHTRANSFORM reference, QByteArray lastProfile, cmsUInt32Number inputFormat, cmsUInt32Number outputFormat)
+{
+    // compare the table against lcms in Lab, in the middle of BLACK_LUT_PROBES cells per
+    // channel, the nodes themselves are exact and the interpolation error peaks between them
+    cmsHPROFILE outputProfile = cmsOpenProfileFromMem(lastProfile.data(), lastProfile.length());
+    cmsHPROFILE labProfile = cmsCreateLab4Profile(NULL);
+    cmsHTRANSFORM toLab = NULL;
+    if (outputProfile && labProfile) {
+        toLab = cmsCreateTransform(outputProfile, outputFormat, labProfile, TYPE_Lab_DBL, INTENT_RELATIVE_COLORIMETRIC, cmsFLAGS_NOCACHE);
+    }
+    if (outputProfile) {
+        cmsCloseProfile(outputProfile);
+    }
+    if (labProfile) {
+        cmsCloseProfile(labProfile);
+    }
+    if (!toLab) {
+        return false;
+    }
+
+    int inputs = lut->inputChannels();
+    int depth = T_BYTES(inputFormat);
+    int outputBytes = T_BYTES(outputFormat)*(T_CHANNELS(outputFormat)+T_EXTRA(outputFormat));
+    int cells = lut->gridPoints()-1;
+    int steps = qMin(BLACK_LUT_PROBES, cells);
+    int probes = 1;
+    for (int i = 0; i < inputs; ++i) {
+        probes *= steps;
+    }
+    QByteArray input(probes*inputs*depth, 0);
+    for (int i = 0; i < probes; ++i) {
+        int index = i;
+        for (int c = inputs-1; c >= 0; --c) {
+            // cells spread over the whole range, first and last included
+            int cell = steps>1?(index%steps)*(cells-1)/(steps-1):0;
+            index /= steps;
+            double position = (cell+0.5)/cells;
+            if (depth == 2) {
+                reinterpret_cast<quint16*>(input.data())[i*inputs+c] = (quint16)floor(position*65535.0+0.5);
+            } else {
+                input[i*inputs+c] = (char)(int)floor(position*255.0+0.5);
+            }
+        }
+    }
+    QByteArray lcmsOutput(probes*outputBytes, 0);
+    QByteArray lutOutput(probes*outputBytes, 0);
+    cmsDoTransform(reference, input.constData(), lcmsOutput.data(), probes);
+    lut->apply(input.constData(), lutOutput.data(), probes);
+    QVector<cmsCIELab> lcmsLab(probes);
+    QVector<cmsCIELab> lutLab(probes);
+    cmsDoTransform(toLab, lcmsOutput.constData(), lcmsLab.data(), probes);
+    cmsDoTransform(toLab, lutOutput.constData(), lutLab.data(), probes);
+    cmsDeleteTransform(toLab);
+
+    double max = 0;
+    double sum = 0;
+    for (int i = 0; i < probes; ++i) {
+        double delta = cmsDeltaE(&lcmsLab[i], &lutLab[i]);
+        max = qMax(max, delta);
+        sum += delta;
+    }
+    return max <= BLACK_LUT_MAX_DELTAE && sum/probes <= BLACK_LUT_MEAN_DELTAE;
+}
+
+blackImage Black::convertImage(blackImage input, QList<QByteArray> profiles, int outputDepth, int intent, bool black, QString *error, blackCancel cancel)
+{
+    blackImage output;
+    if (input.isNull() || profiles.isEmpty()) {
+        return output;
+    }
+
+    output.width = input.width;
+    output.height = input.height;
+    output.depth = outputDepth;
+    output.colorspace = outputColorSpace(profiles.last());
+
+    blackTransform transform = getTransform(profiles, pixelFormat(input.colorspace, input.depth), pixelFormat(output.colorspace, output.depth), intent, black);
+    if (!transform) {
+        if (error) {
+            error->append(tr("Unable to create color transform"));
+        }
+        return blackImage();
+    }
+
+    if (!output.allocate()) {
+        if (error) {
+            error->append(tr("The image is too large, %1 MB packed, the limit is %2 MB").arg(output.byteCount()/1024/1024).arg(BLACK_MAX_BYTES/1024/1024));
+        }
+        return blackImage();
+    }
+    if (!blackTransformRows(transform.data(), input.pixels.constData(), input.bytesPerLine(), output.pixels.data(), output.bytesPerLine(), input.width, input.height, cancel)) {
+        return blackImage();
+    }
+
+    return output;
+}
+
+blackTransform Black::displayTransform(blackImage input, QList<QByteArray> profiles, int intent, bool black, int proof)
+{
+    if (input.isNull() || profiles.isEmpty() || profileColorSpace(profiles.last()) != 1) {
+        return blackTransform();
+    }
+    // converts straight into QImage::Format_RGB32 scanlines
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    cmsUInt32Number outputFormat = TYPE_BGRA_8;
+#else
+    cmsUInt32Number outputFormat = TYPE_ARGB_8;
+#endif
+    return getTransform(profiles, pixelFormat(input.colorspace, input.depth), outputFormat, intent, black, proof);
+}
+
+QImage Black::displayImage(blackImage input, QList<QByteArray> profiles, int intent, bool black, QString *error, blackCancel cancel)
+{
+    blackTransform transform = displayTransform(input, profiles, intent, black);
+    if (!transform) {
+        if (error) {
+            error->append(tr("Unable to create color transform"));
+        }
+        return QImage();
+    }
+    return displayImage(input, transform, QRect(0, 0, input.width, input.height), cancel);
+}
+
+QByteArray Black::deviceLink(QList<QByteArray> profiles, int intent, bool black, QString description, QString *error)
+{
+    // the whole chain with intent and black point compensation baked into one profile
+    QByteArray link;
+    if (profiles.size() < 2) {
+        if (error) {
+            error->append(tr("A device link needs an input and an output profile"));
+        }
+        return link;
+    }
+    cmsUInt32Number inputFormat = pixelFormat(profileColorSpace(profiles.first()), 16);
+    cmsUInt32Number outputFormat = pixelFormat(outputColorSpace(profiles.last()), 16);
+    cmsHTRANSFORM transform = createTransform(profiles, inputFormat, outputFormat, intent, black);
+    if (!transform) {
+        if (error) {
+            error->append(tr("Unable to create color transform"));
+        }
+        return link;
+    }
+    cmsHPROFILE lcmsProfile = cmsTransform2DeviceLink(transform, 4.3, 0);
+    cmsDeleteTransform(transform);
+    if (lcmsProfile) {
+        if (!description.isEmpty()) {
+            cmsMLU *text = cmsMLUalloc(NULL, 1);
+            if (text) {
+                cmsMLUsetASCII(text, "en", "US", description.toLatin1().constData());
+                cmsWriteTag(lcmsProfile, cmsSigProfileDescriptionTag, text);
+                cmsMLUfree(text);
+            }
+        }
+        cmsUInt32Number length = 0;
+        if (cmsSaveProfileToMem(lcmsProfile, NULL, &length) && length > 0) {
+            QByteArray bytes((int)length, 0);
+            if (cmsSaveProfileToMem(lcmsProfile, bytes.data(), &length)) {
+                link = bytes;
+            }
+        }
+        cmsCloseProfile(lcmsProfile);
+    }
+    if (link.isEmpty() && error) {
+        error->append(tr("Unable to create device link"));
+    }
+    return link;
+}
+
+blackTransform Black::gamutTransform(blackImage input, QList<QByteArray> profiles, int intent, bool black)
+{
+    // input and output profile, the distances are sampled on a grid and compiled into
+    // a device link from the input colorspace to gray, lcms interpolates between nodes
+    if (input.isNull() || profiles.size() != 2 || isDeviceLink(profiles.last())) {
+        return blackTransform();
+    }
+    cmsUInt32Number inputFormat = pixelFormat(input.colorspace, input.depth);
+    // colorimetric whatever the selected intent, except absolute which also moves the paper white
+    cmsUInt32Number gamutIntent = intent==3?INTENT_ABSOLUTE_COLORIMETRIC:INTENT_RELATIVE_COLORIMETRIC;
+    QByteArray key = "gamut|" + profileHash(profiles.first()) + profileHash(profiles.last());
+    key.append(QByteArray::number(gamutIntent) + "|" + QByteArray::number(black) + "|" + QByteArray::number(inputFormat));
+    blackTransform cached = blackCacheFind(key);
+    if (cached) {
+        return cached;
+    }
+
+    int inputs = input.channels();
+    int grid = inputs==4?17:(inputs==3?33:256);
+    int nodes = 1;
+    for (int i = 0; i < inputs; ++i) {
+        nodes *= grid;
+    }
+    cmsUInt32Number nodeFormat = pixelFormat(input.colorspace, 16);
+    QVector<cmsUInt16Number> nodeInput(nodes*inputs);
+    for (int i = 0; i < nodes; ++i) {
+        int index = i;
+        for (int c = inputs-1; c >= 0; --c) {
+            nodeInput[i*inputs+c] = (cmsUInt16Number)floor((index%grid)*65535.0/(grid-1)+0.5);
+            index /= grid;
+        }
+    }
+
+    // Lab straight from the input against Lab through the output profile
+    cmsHPROFILE inputProfile = cmsOpenProfileFromMem(profiles.first().data(), profiles.first().length());
+    cmsHPROFILE outputProfile = cmsOpenProfileFromMem(profiles.last().data(), profiles.last().length());
+    cmsHPROFILE labProfile = cmsCreateLab4Profile(NULL);
+    cmsHTRANSFORM toLab = NULL;
+    cmsHTRANSFORM throughOutput = NULL;
+    if (inputProfile && outputProfile && labProfile) {
+        cmsHPROFILE chain[3] = { inputProfile, outputProfile, labProfile };
+        toLab = cmsCreateTransform(inputProfile, nodeFormat, labProfile, TYPE_Lab_DBL, gamutIntent, cmsFLAGS_NOCACHE);
+        throughOutput = cmsCreateMultiprofileTransform(chain, 3, nodeFormat, TYPE_Lab_DBL, gamutIntent, cmsFLAGS_NOCACHE|(black?cmsFLAGS_BLACKPOINTCOMPENSATION:0));
+    }
+    if (inputProfile) {
+        cmsCloseProfile(inputProfile);
+    }
+    if (outputProfile) {
+        cmsCloseProfile(outputProfile);
+    }
+    if (labProfile) {
+        cmsCloseProfile(labProfile);
+    }
+    QVector<cmsUInt16Number> distance(nodes);
+    bool ok = toLab && throughOutput;
+    if (ok) {
+        QVector<cmsCIELab> referenceLab(nodes);
+        QVector<cmsCIELab> outputLab(nodes);
+        cmsDoTransform(toLab, nodeInput.constData(), referenceLab.data(), nodes);
+        cmsDoTransform(throughOutput, nodeInput.constData(), outputLab.data(), nodes);
+        for (int i = 0; i < nodes; ++i) {
+            double delta = cmsDeltaE(&referenceLab[i], &outputLab[i])*BLACK_GAMUT_SCALE;
+            distance[i] = (cmsUInt16Number)qMin(65535.0, delta*257.0);
+        }
+    }
+    if (toLab) {
+        cmsDeleteTransform(toLab);
+    }
+    if (throughOutput) {
+        cmsDeleteTransform(throughOutput);
+    }
+    if (!ok) {
+        return blackTransform();
+    }
+
+    cmsHTRANSFORM handle = NULL;
+    cmsHPROFILE link = cmsCreateProfilePlaceholder(NULL);
+    cmsPipeline *pipeline = cmsPipelineAlloc(NULL, inputs, 1);
+    cmsStage *clut = cmsStageAllocCLut16bit(NULL, grid, inputs, 1, NULL);
+    if (link && pipeline && clut) {
+        blackGamutNodes cargo = { distance.constData(), 0 };
+        cmsStageSampleCLut16bit(clut, blackGamutSampler, &cargo, 0);
+        cmsPipelineInsertStage(pipeline, cmsAT_BEGIN, clut);
+        clut = NULL;
+        cmsSetProfileVersion(link, 4.3);
+        cmsSetDeviceClass(link, cmsSigLinkClass);
+        cmsSetColorSpace(link, inputs==4?cmsSigCmykData:(inputs==3?cmsSigRgbData:cmsSigGrayData));
+        cmsSetPCS(link, cmsSigGrayData);
+        if (cmsWriteTag(link, cmsSigAToB0Tag, pipeline)) {
+            handle = cmsCreateTransform(link, inputFormat, NULL, TYPE_GRAY_8, INTENT_PERCEPTUAL, cmsFLAGS_NOCACHE);
+        }
+    }
+    if (clut) {
+        cmsStageFree(clut);
+    }
+    if (pipeline) {
+        cmsPipelineFree(pipeline);
+    }
+    if (link) {
+        cmsCloseProfile(link);
+    }
+    if (!handle) {
+        return blackTransform();
+    }
+
+    blackTransform transform(new blackTransformData(handle, (qint64)nodes*sizeof(cmsUInt16Number)+4096));
+    blackCacheInsert(key, transform);
+    return transform;
+}
+
+QImage Black::gamutImage(blackImage input, blackTransform gamut, QRect rect, blackCancel cancel)
+{
+    // transparent where the color is in gamut, BLACK_GAMUT_COLOR where it is not
+    QImage output;
+    rect &= QRect(0, 0, input.width, input.height);
+    if (input.isNull() || !gamut || rect.isEmpty()) {
+        return output;
+    }
+    QByteArray distance(rect.width()*rect.height(), 0);
+    int pixelBytes = input.channels()*(input.depth/8);
+    const char *src = input.pixels.constData()+(qint64)rect.y()*input.bytesPerLine()+(qint64)rect.x()*pixelBytes;
+    if (!blackTransformRows(gamut.data(), src, input.bytesPerLine(), distance.data(), rect.width(), rect.width(), rect.height(), cancel)) {
+        return output;
+    }
+
+    output = QImage(rect.width(), rect.height(), QImage::Format_ARGB32_Premultiplied);
+    if (output.isNull()) {
+        return output;
+    }
+    const uchar threshold = (uchar)(BLACK_GAMUT_DELTAE*BLACK_GAMUT_SCALE);
+    for (int y = 0; y < rect.height(); ++y) {
+        const uchar *in = reinterpret_cast<const uchar*>(distance.constData())+y*rect.width();
+        QRgb *out = reinterpret_cast<QRgb*>(output.scanLine(y));
+        for (int x = 0; x < rect.width(); ++x) {
+            out[x] = in[x]>threshold?BLACK_GAMUT_COLOR:0;
+        }
+    }
+    return output;
+}
+
+blackTransform Black::coverageTransform(blackImage input, QList<QByteArray> profiles, int intent, bool black)
+{
+    // the ink amounts of the output, only CMYK outputs have a coverage to check
+    if (input.isNull() || profiles.isEmpty() || outputColorSpace(profiles.last()) != 2) {
+        return blackTransform();
+    }
+    return getTransform(profiles, pixelFormat(input.colorspace, input.depth), TYPE_CMYK_8, intent, black);
+}
+
+blackCoverage Black::inkCoverage(blackImage input, blackTransform coverage, blackCancel cancel)
+{
+    // a histogram per band, added up when all bands are done
+    blackCoverage result;
+    if (input.isNull() || !coverage) {
+        return result;
+    }
+    int rows = input.height;
+    int bands = qMin(blackThreadCount, qMax(1, rows/BLACK_BAND_ROWS));
+    int step = (rows+bands-1)/qMax(1, bands);
+    const char *src = input.pixels.constData();
+    qint64 stride = input.bytesPerLine();
+    QSemaphore done;
+    QList<blackCoverageBand*> started;
+    for (int y = step; y < rows; y += step) {
+        blackCoverageBand *band = new blackCoverageBand(coverage.data(), src+y*stride, stride, input.width, qMin(step, rows-y), cancel, &done);
+        band->setAutoDelete(false);
+        started << band;
+        blackPool()->start(band);
+    }
+    blackCoverageBand first(coverage.data(), src, stride, input.width, qMin(step, rows), cancel, 0);
+    first.run();
+    done.acquire(started.size());
+    result.histogram = first.histogram;
+    for (int i = 0; i < started.size(); ++i) {
+        for (int bin = 0; bin < result.histogram.size(); ++bin) {
+            result.histogram[bin] += started.at(i)->histogram.at(bin);
+        }
+    }
+    qDeleteAll(started);
+    if (cancel.cancelled()) {
+        return blackCoverage();
+    }
+    return result;
+}
+
+QImage Black::coverageImage(blackImage input, blackTransform coverage, QRect rect, int limit, blackCancel cancel)
+{
+    // heat map, transparent up to 100% under the limit, then yellow to orange, red past it
+    QImage output;
+    rect &= QRect(0, 0, input.width, input.height);
+    if (input.isNull() || !coverage || rect.isEmpty()) {
+        return output;
+    }
+    QByteArray ink(rect.width()*rect.height()*4, 0);
+    int pixelBytes = input.channels()*(input.depth/8);
+    const char *src = input.pixels.constData()+(qint64)rect.y()*input.bytesPerLine()+(qint64)rect.x()*pixelBytes;
+    if (!blackTransformRows(coverage.data(), src, input.bytesPerLine(), ink.data(), rect.width()*4, rect.width(), rect.height(), cancel)) {
+        return output;
+    }
+
+    QVector<QRgb> heat(4*BLACK_COVERAGE_STEPS+1, 0);
+    int top = limit*BLACK_COVERAGE_STEPS/100;
+    int bottom = qMax(0, top-BLACK_COVERAGE_STEPS);
+    for (int i = bottom; i < heat.size(); ++i) {
+        int red = 255;
+        int green = 0;
+        int alpha = 0xc0;
+        if (i <= top) {
+            green = 255-(i-bottom)*127/qMax(1, top-bottom);
+            alpha = 0x40+(i-bottom)*0x50/qMax(1, top-bottom);
+        }
+        heat[i] = qRgba(red*alpha/255, green*alpha/255, 0, alpha);
+    }
+
+    output = QImage(rect.width(), rect.height(), QImage::Format_ARGB32_Premultiplied);
+    if (output.isNull()) {
+        return output;
+    }
+    for (int y = 0; y < rect.height(); ++y) {
+        const uchar *cmyk = reinterpret_cast<const uchar*>(ink.constData())+(qint64)y*rect.width()*4;
+        QRgb *out = reinterpret_cast<QRgb*>(output.scanLine(y));
+        for (int x = 0; x < rect.width(); ++x, cmyk += 4) {
+            out[x] = heat.at(cmyk[0]+cmyk[1]+cmyk[2]+cmyk[3]);
+        }
+    }
+    return output;
+}
+
+QImage Black::displayImage(blackImage input, blackTransform transform, QRect rect, blackCancel cancel)
+{
+    QImage output;
+    rect &= QRect(0, 0, input.width, input.height);
+    if (input.isNull() || rect.isEmpty()) {
+        return output;
+    }
+    if (!transform) {
+        return rawImage(input, rect);
+    }
+
+    output = QImage(rect.width(), rect.height(), QImage::Format_RGB32);
+    if (output.isNull()) {
+        return output;
+    }
+    output.fill(0xffffffff);
+    int pixelBytes = input.channels()*(input.depth/8);
+    const char *src = input.pixels.constData()+(qint64)rect.y()*input.bytesPerLine()+(qint64)rect.x()*pixelBytes;
+    if (!blackTransformRows(transform.data(), src, input.bytesPerLine(), reinterpret_cast<char*>(output.bits()), output.bytesPerLine(), rect.width(), rect.height(), cancel)) {
+        return QImage();
+    }
+
+    return output;
+}
+
+QImage Black::rawImage(blackImage input, QRect rect)
+{
+    // unmanaged view of the pixels, used when there is nothing to convert
+    QImage output;
+    rect &= QRect(0, 0, input.width, input.height);
+    if (input.isNull() || rect.isEmpty()) {
+        return output;
+    }
+    output = QImage(rect.width(), rect.height(), QImage::Format_RGB32);
+    if (output.isNull()) {
+        return output;
+    }
+    int channels = input.channels();
+    int shift = input.depth==16?8:0;
+    for (int y = 0; y < rect.height(); ++y) {
+        QRgb *dst = reinterpret_cast<QRgb*>(output.scanLine(y));
+        const uchar *src8 = reinterpret_cast<const uchar*>(input.pixels.constData())+(qint64)(rect.y()+y)*input.bytesPerLine()+(qint64)rect.x()*channels*(input.depth/8);
+        const quint16 *src16 = reinterpret_cast<const quint16*>(src8);
+        for (int x = 0; x < rect.width(); ++x) {
+            int c[4];
+            for (int i = 0; i < channels; ++i) {
+                c[i] = input.depth==16?src16[x*channels+i]>>shift:src8[x*channels+i];
+            }
+            if (channels == 4) {
+                dst[x] = qRgb((255-c[0])*(255-c[3])/255, (255-c[1])*(255-c[3])/255, (255-c[2])*(255-c[3])/255);
+            } else if (channels == 1) {
+                dst[x] = qRgb(c[0], c[0], c[0]);
+            } else {
+                dst[x] = qRgb(c[0], c[1], c[2]);
+            }
+        }
+    }
+    return output;
+}
+
+blackImage Black::halfImage(blackImage input, blackCancel cancel)
+{
+    // 2x2 box filter, used for the viewer pyramid levels
+    blackImage output;
+    if (input.isNull() || (input.width < 2 && input.height < 2)) {
+        return output;
+    }
+    output.colorspace = input.colorspace;
+    output.depth = input.depth;
+    output.width = qMax(1, input.width/2);
+    output.height = qMax(1, input.height/2);
+    if (!output.allocate()) {
+        return blackImage();
+    }
+
+    int channels = input.channels();
+    const char *src = input.pixels.constData();
+    char *dst = output.pixels.data();
+    for (int y = 0; y < output.height; ++y) {
+        if (cancel.cancelled()) {
+            return blackImage();
+        }
+        const char *line0 = src+(qint64)qMin(y*2, input.height-1)*input.bytesPerLine();
+        const char *line1 = src+(qint64)qMin(y*2+1, input.height-1)*input.bytesPerLine();
+        char *out = dst+(qint64)y*output.bytesPerLine();
+        for (int x = 0; x < output.width; ++x) {
+            int x0 = qMin(x*2, input.width-1)*channels;
+            int x1 = qMin(x*2+1, input.width-1)*channels;
+            for (int c = 0; c < channels; ++c) {
+                if (input.depth == 16) {
+                    const quint16 *row0 = reinterpret_cast<const quint16*>(line0);
+                    const quint16 *row1 = reinterpret_cast<const quint16*>(line1);
+                    reinterpret_cast<quint16*>(out)[x*channels+c] = (row0[x0+c]+row0[x1+c]+row1[x0+c]+row1[x1+c]+2)/4;
+                } else {
+                    const uchar *row0 = reinterpret_cast<const uchar*>(line0);
+                    const uchar *row1 = reinterpret_cast<const uchar*>(line1);
+                    reinterpret_cast<uchar*>(out)[x*channels+c] = (row0[x0+c]+row0[x1+c]+row1[x0+c]+row1[x1+c]+2)/4;
+                }
+            }
+        }
+    }
+    return output;
+}
+
+blackImage Black::sampleImage(blackImage input, int size)
+{
+    // nearest neighbour reduction so the longest side fits size, only the output
+    // pixels are read, used for the quick first preview pass
+    if (input.isNull() || size < 1 || (input.width <= size && input.height <= size)) {
+        return input;
+    }
+    blackImage output;
+    output.colorspace = input.colorspace;
+    output.depth = input.depth;
+    qreal factor = (qreal)qMax(input.width, input.height)/size;
+    output.width = qBound(1, qRound(input.width/factor), size);
+    output.height = qBound(1, qRound(input.height/factor), size);
+    if (!output.allocate()) {
+        return blackImage();
+    }
+
+    int pixelBytes = input.channels()*(input.depth/8);
+    QVector<qint64> columns(output.width);
+    for (int x = 0; x < output.width; ++x) {
+        columns[x] = (qint64)qMin(input.width-1, (int)((x+0.5)*input.width/output.width))*pixelBytes;
+    }
+    for (int y = 0; y < output.height; ++y) {
+        const char *line = input.pixels.constData()+(qint64)qMin(input.height-1, (int)((y+0.5)*input.height/output.height))*input.bytesPerLine();
+        char *out = output.pixels.data()+(qint64)y*output.bytesPerLine();
+        for (int x = 0; x < output.width; ++x) {
+            memcpy(out+x*pixelBytes, line+columns.at(x), pixelBytes);
+        }
+    }
+    return output;
+}
@@ -0,0 +1,154 @@
+/*
+* Cyan <https://github.com/olear/cyan>,
+* Copyright (C) 2016 Ole-André Rodlie
+*
+* Cyan is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License version 2 as published
+* by the Free Software Foundation.
+*
+* Cyan is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Cyan.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+*/
+
+#ifndef BLACK_H
+#define BLACK_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QList>
+#include <QString>
+#include <QSharedPointer>
+#include <QImage>
+#include <QAtomicInt>
+#include <QRect>
+#include <QVector>
+#include <lcms2.h>
+
+#include "blacklut.h"
+
+// soft proofing, a chain of input, proof and display profiles is built as one
+// lcms proofing transform
+#define BLACK_PROOF_NONE 0
+#define BLACK_PROOF_SOFT 1
+
+// gamut warning, a pixel is out of gamut when it moves more than BLACK_GAMUT_DELTAE
+// (CIE76) converted colorimetrically to the output profile and back to Lab, the
+// gamut transform gives that distance as 8-bit gray, BLACK_GAMUT_SCALE levels per unit
+#define BLACK_GAMUT_DELTAE 3.0
+#define BLACK_GAMUT_SCALE 10
+#define BLACK_GAMUT_COLOR 0xa000a000 // premultiplied ARGB, translucent green
+
+// total area coverage (TAC), the sum of the four inks of a CMYK pixel, 0 to 400%
+// in 8-bit steps (BLACK_COVERAGE_STEPS per ink, 4*255 for a pixel)
+#define BLACK_COVERAGE_STEPS 255
+#define BLACK_COVERAGE_LIMIT 300 // %
+
+// one QByteArray holds the packed pixels of an image, it can not grow past 2 GB
+#define BLACK_MAX_BYTES Q_INT64_C(2146435072) // 2047 MB
+
+// packed pixels, colorspace uses the same values as Yellow (1=RGB, 2=CMYK, 3=GRAY)
+struct blackImage {
+    QByteArray pixels;
+    int width;
+    int height;
+    int colorspace;
+    int depth;
+    blackImage() : width(0), height(0), colorspace(0), depth(0) {}
+    int channels() const { return colorspace==2?4:(colorspace==3?1:3); }
+    qint64 bytesPerLine() const { return (qint64)width*channels()*(depth/8); }
+    qint64 byteCount() const { return bytesPerLine()*height; }
+    bool fits() const { return byteCount() <= BLACK_MAX_BYTES; }
+    bool isNull() const { return pixels.isEmpty() || width<1 || height<1; }
+    bool allocate();
+};
+
+// compiled lcms transform, shared between the cache and any running conversion
+// lut is an optional faster table for the same conversion, see blacklut.h
+struct blackTransformData {
+    cmsHTRANSFORM handle;
+    blackLut *lut;
+    qint64 cost;
+    blackTransformData(cmsHTRANSFORM transform, qint64 bytes) : handle(transform), lut(0), cost(bytes) {}
+    ~blackTransformData() { if (handle) { cmsDeleteTransform(handle); } delete lut; }
+};
+typedef QSharedPointer<blackTransformData> blackTransform;
+
+// a conversion stops as soon as the counter no longer matches its ticket
+struct blackCancel {
+    QAtomicInt *counter;
+    int ticket;
+    blackCancel(QAtomicInt *latest = 0, int generation = 0) : counter(latest), ticket(generation) {}
+    bool cancelled() const { return counter && counter->fetchAndAddRelaxed(0) != ticket; }
+};
+
+// TAC histogram of an image, the statistics for any limit come from it without
+// touching the pixels again
+struct blackCoverage {
+    QVector<qint64> histogram;
+    qint64 pixels() const;
+    int max() const;
+    double mean() const;
+    double over(int limit) const;
+};
+
+struct blackCacheStats {
+    qint64 hits;
+    qint64 misses;
+    qint64 evictions;
+    qint64 cost;
+    qint64 limit;
+    int count;
+};
+
+class Black : public QObject
+{
+    Q_OBJECT
+public:
+    explicit Black(QObject *parent = 0);
+    ~Black();
+
+public slots:
+    int profileColorSpace(QByteArray profile);
+    int outputColorSpace(QByteArray profile);
+    bool isDeviceLink(QByteArray profile);
+    QByteArray displayProfile();
+    cmsUInt32Number pixelFormat(int colorspace, int depth);
+    cmsUInt32Number renderingIntent(int intent);
+    cmsHTRANSFORM createTransform(QList<QByteArray> profiles, cmsUInt32Number inputFormat, cmsUInt32Number outputFormat, int intent, bool black, int proof = BLACK_PROOF_NONE);
+    blackTransform getTransform(QList<QByteArray> profiles, cmsUInt32Number inputFormat, cmsUInt32Number outputFormat, int intent, bool black, int proof = BLACK_PROOF_NONE);
+    blackImage convertImage(blackImage input, QList<QByteArray> profiles, int outputDepth, int intent, bool black, QString *error, blackCancel cancel = blackCancel());
+    blackTransform displayTransform(blackImage input, QList<QByteArray> profiles, int intent, bool black, int proof = BLACK_PROOF_NONE);
+    QImage displayImage(blackImage input, QList<QByteArray> profiles, int intent, bool black, QString *error, blackCancel cancel = blackCancel());
+    QByteArray deviceLink(QList<QByteArray> profiles, int intent, bool black, QString description, QString *error);
+    blackTransform gamutTransform(blackImage input, QList<QByteArray> profiles, int intent, bool black);
+    QImage gamutImage(blackImage input, blackTransform gamut, QRect rect, blackCancel cancel = blackCancel());
+    blackTransform coverageTransform(blackImage input, QList<QByteArray> profiles, int intent, bool black);
+    blackCoverage inkCoverage(blackImage input, blackTransform coverage, blackCancel cancel = blackCancel());
+    QImage coverageImage(blackImage input, blackTransform coverage, QRect rect, int limit, blackCancel cancel = blackCancel());
+    QImage displayImage(blackImage input, blackTransform transform, QRect rect, blackCancel cancel = blackCancel());
+    QImage rawImage(blackImage input, QRect rect);
+    blackImage halfImage(blackImage input, blackCancel cancel = blackCancel());
+    blackImage sampleImage(blackImage input, int size);
+
+public:
+    static QByteArray profileHash(QByteArray profile);
+    static void setThreads(int threads);
+    static int threads();
+    static void setCacheLimit(qint64 bytes);
+    static blackCacheStats cacheStats();
+    static void clearCache();
+    static void setLookupTables(bool enabled);
+    static bool lookupTables();
+
+private:
+    static int colorSpace(cmsColorSpaceSignature space);
+    blackLut *createLut(QList<QByteArray> profiles, cmsUInt32Number inputFormat, cmsUInt32Number outputFormat, int intent, bool black, int proof);
+    bool checkLut(const blackLut *lut, cmsHTRANSFORM reference, QByteArray lastProfile, cmsUInt32Number inputFormat, cmsUInt32Number outputFormat);
+};
+
+#endif // BLACK_H
@@ -0,0 +1,376 @@
+/*
+* Cyan <https://github.com/olear/cyan>,
+* Copyright (C) 2016 Ole-André Rodlie
+*
+* Cyan is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License version 2 as published
+* by the Free Software Foundation.
+*
+* Cyan is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Cyan.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+*/
+
+#include "blacklut.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BLACK_LUT_X86
+#include <immintrin.h>
+#endif
+
+blackLut::blackLut(int inputChannels, int inputDepth, int outputChannels, bool bgra, int gridPoints)
+    : inputs(inputChannels)
+    , depth(inputDepth)
+    , outputs(outputChannels)
+    , pad(bgra && outputChannels == 3)
+    , grid(gridPoints)
+{
+    // channel 0 is the most significant axis, the last input channel is innermost
+    int stride = outputs;
+    for (int i = inputs-1; i >= 0; --i) {
+        strides[i] = stride;
+        stride *= grid;
+    }
+    for (int i = inputs; i < 4; ++i) {
+        strides[i] = 0;
+    }
+    // two extra entries, the vector kernels read 32 bits for every 16-bit entry
+    table.resize(stride+2, 0);
+}
+
+int blackLut::nodes() const
+{
+    int count = 1;
+    for (int i = 0; i < inputs; ++i) {
+        count *= grid;
+    }
+    return count;
+}
+
+void blackLut::setNode(int node, const unsigned short *values)
+{
+    // stored as 8.8 fixed point 8-bit values
+    for (int c = 0; c < outputs; ++c) {
+        table[node*outputs+c] = (unsigned short)(((unsigned)values[c]*65280u+32767u)/65535u);
+    }
+}
+
+void blackLut::nodeInput(int node, unsigned short *values) const
+{
+    for (int i = inputs-1; i >= 0; --i) {
+        values[i] = (unsigned short)((node%grid)*65535/(grid-1));
+        node /= grid;
+    }
+}
+
+void blackLut::apply(const void *src, void *dst, int pixels) const
+{
+    static Kernel kernel = bestKernel();
+    apply(src, dst, pixels, kernel);
+}
+
+void blackLut::apply(const void *src, void *dst, int pixels, Kernel kernel) const
+{
+    const unsigned char *input = static_cast<const unsigned char*>(src);
+    unsigned char *output = static_cast<unsigned char*>(dst);
+#ifdef BLACK_LUT_X86
+    if (kernel == AVX2Kernel) {
+        applyAVX2(input, output, pixels);
+        return;
+    }
+    if (kernel == SSE41Kernel) {
+        applySSE41(input, output, pixels);
+        return;
+    }
+#else
+    (void)kernel;
+#endif
+    applyScalar(input, output, pixels);
+}
+
+blackLut::Kernel blackLut::bestKernel()
+{
+#ifdef BLACK_LUT_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return AVX2Kernel;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return SSE41Kernel;
+    }
+#endif
+    return ScalarKernel;
+}
+
+void blackLut::applyScalar(const unsigned char *src, unsigned char *dst, int pixels) const
+{
+    const int pixelBytes = inputs*depth/8;
+    const int outputBytes = pad?4:outputs;
+    const unsigned n1 = grid-1;
+    const unsigned short *lut = &table[0];
+    const int sx = strides[0], sy = strides[1], sz = strides[2], sk = strides[3];
+
+    for (int i = 0; i < pixels; ++i) {
+        const unsigned char *in = src+i*pixelBytes;
+        int index[4];
+        int frac[4];
+        for (int c = 0; c < inputs; ++c) {
+            unsigned value = depth==16?reinterpret_cast<const unsigned short*>(in)[c]:in[c]*257u;
+            unsigned position = (value*n1)>>8;
+            index[c] = position>>8;
+            frac[c] = position&255;
+        }
+        int base = index[0]*sx+index[1]*sy+index[2]*sz;
+        if (inputs == 4) {
+            base += index[3]*sk;
+        }
+
+        // tetrahedral weights, A is the largest axis (x before y before z), min the smallest (z before y before x)
+        int fx = frac[0], fy = frac[1], fz = frac[2];
+        int oa, omin, wmax, wmin;
+        if (fx >= fy && fx >= fz) {
+            oa = sx;
+            wmax = fx;
+        } else if (fy >= fz) {
+            oa = sy;
+            wmax = fy;
+        } else {
+            oa = sz;
+            wmax = fz;
+        }
+        if (fz <= fy && fz <= fx) {
+            omin = sz;
+            wmin = fz;
+        } else if (fy <= fx) {
+            omin = sy;
+            wmin = fy;
+        } else {
+            omin = sx;
+            wmin = fx;
+        }
+        int wmid = fx+fy+fz-wmax-wmin;
+        int oc = sx+sy+sz;
+        int ob = oc-omin;
+        int w0 = 256-wmax, w1 = wmax-wmid, w2 = wmid-wmin, w3 = wmin;
+
+        unsigned char *out = dst+i*outputBytes;
+        for (int c = 0; c < outputs; ++c) {
+            const unsigned short *t = lut+base+c;
+            unsigned value = t[0]*w0+t[oa]*w1+t[ob]*w2+t[oc]*w3;
+            if (inputs == 4) {
+                const unsigned short *k = t+sk;
+                unsigned next = k[0]*w0+k[oa]*w1+k[ob]*w2+k[oc]*w3;
+                value = ((value+128)>>8)*(256-frac[3])+((next+128)>>8)*frac[3];
+            }
+            out[c] = (unsigned char)((value+32768)>>16);
+        }
+        if (pad) {
+            out[3] = 0xff;
+        }
+    }
+}
+
+#ifdef BLACK_LUT_X86
+
+__attribute__((target("sse4.1")))
+static inline __m128i blackLutFetch4(const unsigned short *lut, __m128i index)
+{
+    return _mm_setr_epi32(lut[_mm_extract_epi32(index, 0)], lut[_mm_extract_epi32(index, 1)], lut[_mm_extract_epi32(index, 2)], lut[_mm_extract_epi32(index, 3)]);
+}
+
+__attribute__((target("sse4.1")))
+void blackLut::applySSE41(const unsigned char *src, unsigned char *dst, int pixels) const
+{
+    const int pixelBytes = inputs*depth/8;
+    const int outputBytes = pad?4:outputs;
+    const unsigned short *lut = &table[0];
+    const __m128i n1 = _mm_set1_epi32(grid-1);
+    const __m128i mask8 = _mm_set1_epi32(255);
+    const __m128i round8 = _mm_set1_epi32(128);
+    const __m128i round16 = _mm_set1_epi32(32768);
+    const __m128i full = _mm_set1_epi32(256);
+    const __m128i sx = _mm_set1_epi32(strides[0]);
+    const __m128i sy = _mm_set1_epi32(strides[1]);
+    const __m128i sz = _mm_set1_epi32(strides[2]);
+    const __m128i oc = _mm_set1_epi32(strides[0]+strides[1]+strides[2]);
+    const int blocks = pixels/4*4;
+
+    for (int i = 0; i < blocks; i += 4) {
+        __m128i index[4];
+        __m128i frac[4];
+        for (int c = 0; c < inputs; ++c) {
+            unsigned v[4];
+            for (int p = 0; p < 4; ++p) {
+                const unsigned char *in = src+(i+p)*pixelBytes;
+                v[p] = depth==16?reinterpret_cast<const unsigned short*>(in)[c]:in[c]*257u;
+            }
+            __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(v));
+            __m128i position = _mm_srli_epi32(_mm_mullo_epi32(value, n1), 8);
+            index[c] = _mm_srli_epi32(position, 8);
+            frac[c] = _mm_and_si128(position, mask8);
+        }
+        __m128i base = _mm_add_epi32(_mm_add_epi32(_mm_mullo_epi32(index[0], sx), _mm_mullo_epi32(index[1], sy)), _mm_mullo_epi32(index[2], sz));
+        if (inputs == 4) {
+            base = _mm_add_epi32(base, _mm_mullo_epi32(index[3], _mm_set1_epi32(strides[3])));
+        }
+
+        __m128i fx = frac[0], fy = frac[1], fz = frac[2];
+        __m128i wmax = _mm_max_epi32(_mm_max_epi32(fx, fy), fz);
+        __m128i wmin = _mm_min_epi32(_mm_min_epi32(fx, fy), fz);
+        __m128i wmid = _mm_sub_epi32(_mm_sub_epi32(_mm_add_epi32(_mm_add_epi32(fx, fy), fz), wmax), wmin);
+        __m128i xmax = _mm_andnot_si128(_mm_or_si128(_mm_cmpgt_epi32(fy, fx), _mm_cmpgt_epi32(fz, fx)), _mm_set1_epi32(-1));
+        __m128i ymax = _mm_andnot_si128(_mm_or_si128(xmax, _mm_cmpgt_epi32(fz, fy)), _mm_set1_epi32(-1));
+        __m128i oa = _mm_blendv_epi8(_mm_blendv_epi8(sz, sy, ymax), sx, xmax);
+        __m128i zmin = _mm_andnot_si128(_mm_or_si128(_mm_cmpgt_epi32(fz, fy), _mm_cmpgt_epi32(fz, fx)), _mm_set1_epi32(-1));
+        __m128i ymin = _mm_andnot_si128(_mm_or_si128(zmin, _mm_cmpgt_epi32(fy, fx)), _mm_set1_epi32(-1));
+        __m128i omin = _mm_blendv_epi8(_mm_blendv_epi8(sx, sy, ymin), sz, zmin);
+        __m128i ob = _mm_sub_epi32(oc, omin);
+        __m128i w0 = _mm_sub_epi32(full, wmax);
+        __m128i w1 = _mm_sub_epi32(wmax, wmid);
+        __m128i w2 = _mm_sub_epi32(wmid, wmin);
+        __m128i w3 = wmin;
+
+        __m128i result[4];
+        for (int c = 0; c < outputs; ++c) {
+            __m128i slice[2];
+            for (int s = 0; s < (inputs==4?2:1); ++s) {
+                __m128i b = _mm_add_epi32(base, _mm_set1_epi32(c+s*strides[3]));
+                __m128i value = _mm_mullo_epi32(blackLutFetch4(lut, b), w0);
+                value = _mm_add_epi32(value, _mm_mullo_epi32(blackLutFetch4(lut, _mm_add_epi32(b, oa)), w1));
+                value = _mm_add_epi32(value, _mm_mullo_epi32(blackLutFetch4(lut, _mm_add_epi32(b, ob)), w2));
+                value = _mm_add_epi32(value, _mm_mullo_epi32(blackLutFetch4(lut, _mm_add_epi32(b, oc)), w3));
+                slice[s] = value;
+            }
+            if (inputs == 4) {
+                __m128i k0 = _mm_srli_epi32(_mm_add_epi32(slice[0], round8), 8);
+                __m128i k1 = _mm_srli_epi32(_mm_add_epi32(slice[1], round8), 8);
+                slice[0] = _mm_add_epi32(_mm_mullo_epi32(k0, _mm_sub_epi32(full, frac[3])), _mm_mullo_epi32(k1, frac[3]));
+            }
+            result[c] = _mm_srli_epi32(_mm_add_epi32(slice[0], round16), 16);
+        }
+
+        unsigned char *out = dst+i*outputBytes;
+        if (outputBytes == 4) {
+            __m128i packed = _mm_or_si128(_mm_or_si128(result[0], _mm_slli_epi32(result[1], 8)), _mm_slli_epi32(result[2], 16));
+            packed = _mm_or_si128(packed, pad?_mm_set1_epi32(0xff000000):_mm_slli_epi32(result[3], 24));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), packed);
+        } else {
+            unsigned values[4][4];
+            for (int c = 0; c < outputs; ++c) {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(values[c]), result[c]);
+            }
+            for (int p = 0; p < 4; ++p) {
+                for (int c = 0; c < outputs; ++c) {
+                    out[p*outputBytes+c] = (unsigned char)values[c][p];
+                }
+            }
+        }
+    }
+    applyScalar(src+blocks*pixelBytes, dst+blocks*outputBytes, pixels-blocks);
+}
+
+__attribute__((target("avx2")))
+void blackLut::applyAVX2(const unsigned char *src, unsigned char *dst, int pixels) const
+{
+    const int pixelBytes = inputs*depth/8;
+    const int outputBytes = pad?4:outputs;
+    const int *lut = reinterpret_cast<const int*>(&table[0]);
+    const __m256i lanes = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(pixelBytes));
+    const __m256i n1 = _mm256_set1_epi32(grid-1);
+    const __m256i mask8 = _mm256_set1_epi32(255);
+    const __m256i mask16 = _mm256_set1_epi32(65535);
+    const __m256i ones = _mm256_set1_epi32(-1);
+    const __m256i round8 = _mm256_set1_epi32(128);
+    const __m256i round16 = _mm256_set1_epi32(32768);
+    const __m256i full = _mm256_set1_epi32(256);
+    const __m256i sx = _mm256_set1_epi32(strides[0]);
+    const __m256i sy = _mm256_set1_epi32(strides[1]);
+    const __m256i sz = _mm256_set1_epi32(strides[2]);
+    const __m256i oc = _mm256_set1_epi32(strides[0]+strides[1]+strides[2]);
+    // channels are gathered as 32-bit words, keep the last pixel scalar so no read passes the end
+    const int blocks = pixels>1?(pixels-1)/8*8:0;
+
+    for (int i = 0; i < blocks; i += 8) {
+        const int *in = reinterpret_cast<const int*>(src+i*pixelBytes);
+        __m256i index[4];
+        __m256i frac[4];
+        for (int c = 0; c < inputs; ++c) {
+            __m256i value = _mm256_i32gather_epi32(in, _mm256_add_epi32(lanes, _mm256_set1_epi32(c*depth/8)), 1);
+            if (depth == 16) {
+                value = _mm256_and_si256(value, mask16);
+            } else {
+                value = _mm256_mullo_epi32(_mm256_and_si256(value, mask8), _mm256_set1_epi32(257));
+            }
+            __m256i position = _mm256_srli_epi32(_mm256_mullo_epi32(value, n1), 8);
+            index[c] = _mm256_srli_epi32(position, 8);
+            frac[c] = _mm256_and_si256(position, mask8);
+        }
+        __m256i base = _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(index[0], sx), _mm256_mullo_epi32(index[1], sy)), _mm256_mullo_epi32(index[2], sz));
+        if (inputs == 4) {
+            base = _mm256_add_epi32(base, _mm256_mullo_epi32(index[3], _mm256_set1_epi32(strides[3])));
+        }
+
+        __m256i fx = frac[0], fy = frac[1], fz = frac[2];
+        __m256i wmax = _mm256_max_epi32(_mm256_max_epi32(fx, fy), fz);
+        __m256i wmin = _mm256_min_epi32(_mm256_min_epi32(fx, fy), fz);
+        __m256i wmid = _mm256_sub_epi32(_mm256_sub_epi32(_mm256_add_epi32(_mm256_add_epi32(fx, fy), fz), wmax), wmin);
+        __m256i xmax = _mm256_andnot_si256(_mm256_or_si256(_mm256_cmpgt_epi32(fy, fx), _mm256_cmpgt_epi32(fz, fx)), ones);
+        __m256i ymax = _mm256_andnot_si256(_mm256_or_si256(xmax, _mm256_cmpgt_epi32(fz, fy)), ones);
+        __m256i oa = _mm256_blendv_epi8(_mm256_blendv_epi8(sz, sy, ymax), sx, xmax);
+        __m256i zmin = _mm256_andnot_si256(_mm256_or_si256(_mm256_cmpgt_epi32(fz, fy), _mm256_cmpgt_epi32(fz, fx)), ones);
+        __m256i ymin = _mm256_andnot_si256(_mm256_or_si256(zmin, _mm256_cmpgt_epi32(fy, fx)), ones);
+        __m256i omin = _mm256_blendv_epi8(_mm256_blendv_epi8(sx, sy, ymin), sz, zmin);
+        __m256i ob = _mm256_sub_epi32(oc, omin);
+        __m256i w0 = _mm256_sub_epi32(full, wmax);
+        __m256i w1 = _mm256_sub_epi32(wmax, wmid);
+        __m256i w2 = _mm256_sub_epi32(wmid, wmin);
+        __m256i w3 = wmin;
+
+        __m256i result[4];
+        for (int c = 0; c < outputs; ++c) {
+            __m256i slice[2];
+            for (int s = 0; s < (inputs==4?2:1); ++s) {
+                __m256i b = _mm256_add_epi32(base, _mm256_set1_epi32(c+s*strides[3]));
+                __m256i t0 = _mm256_and_si256(_mm256_i32gather_epi32(lut, b, 2), mask16);
+                __m256i t1 = _mm256_and_si256(_mm256_i32gather_epi32(lut, _mm256_add_epi32(b, oa), 2), mask16);
+                __m256i t2 = _mm256_and_si256(_mm256_i32gather_epi32(lut, _mm256_add_epi32(b, ob), 2), mask16);
+                __m256i t3 = _mm256_and_si256(_mm256_i32gather_epi32(lut, _mm256_add_epi32(b, oc), 2), mask16);
+                __m256i value = _mm256_mullo_epi32(t0, w0);
+                value = _mm256_add_epi32(value, _mm256_mullo_epi32(t1, w1));
+                value = _mm256_add_epi32(value, _mm256_mullo_epi32(t2, w2));
+                value = _mm256_add_epi32(value, _mm256_mullo_epi32(t3, w3));
+                slice[s] = value;
+            }
+            if (inputs == 4) {
+                __m256i k0 = _mm256_srli_epi32(_mm256_add_epi32(slice[0], round8), 8);
+                __m256i k1 = _mm256_srli_epi32(_mm256_add_epi32(slice[1], round8), 8);
+                slice[0] = _mm256_add_epi32(_mm256_mullo_epi32(k0, _mm256_sub_epi32(full, frac[3])), _mm256_mullo_epi32(k1, frac[3]));
+            }
+            result[c] = _mm256_srli_epi32(_mm256_add_epi32(slice[0], round16), 16);
+        }
+
+        unsigned char *out = dst+i*outputBytes;
+        if (outputBytes == 4) {
+            __m256i packed = _mm256_or_si256(_mm256_or_si256(result[0], _mm256_slli_epi32(result[1], 8)), _mm256_slli_epi32(result[2], 16));
+            packed = _mm256_or_si256(packed, pad?_mm256_set1_epi32(0xff000000):_mm256_slli_epi32(result[3], 24));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), packed);
+        } else {
+            unsigned values[4][8];
+            for (int c = 0; c < outputs; ++c) {
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(values[c]), result[c]);
+            }
+            for (int p = 0; p < 8; ++p) {
+                for (int c = 0; c < outputs; ++c) {
+                    out[p*outputBytes+c] = (unsigned char)values[c][p];
+                }
+            }
+        }
+    }
+    applyScalar(src+blocks*pixelBytes, dst+blocks*outputBytes, pixels-blocks);
+}
+
+#endif
@@ -0,0 +1,75 @@
+/*
+* Cyan <https://github.com/olear/cyan>,
+* Copyright (C) 2016 Ole-André Rodlie
+*
+* Cyan is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License version 2 as published
+* by the Free Software Foundation.
+*
+* Cyan is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Cyan.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+*/
+
+#ifndef BLACKLUT_H
+#define BLACKLUT_H
+
+#include <vector>
+
+// Precalculated conversion table for 3 (RGB) or 4 (CMYK) channel 8/16-bit input
+// and 8-bit output. 3D lookups use tetrahedral interpolation, 4D lookups
+// interpolate two 3D slices linearly in the last channel (K), the same scheme
+// lcms uses for its 16-bit precalculated transforms.
+//
+// Black fills the nodes from lcms and only uses a table when it matches the
+// lcms transform within BLACK_LUT_MAX_DELTAE (max) and BLACK_LUT_MEAN_DELTAE
+// (mean) dE76 on probes between the nodes, otherwise the conversion stays in lcms.
+//
+// Kernels: AVX2 (8 pixels), SSE4.1 (4 pixels) and scalar, picked at runtime.
+
+#define BLACK_LUT_MAX_DELTAE 2.0
+#define BLACK_LUT_MEAN_DELTAE 0.5
+
+class blackLut
+{
+public:
+    enum Kernel {
+        ScalarKernel = 0,
+        SSE41Kernel = 1,
+        AVX2Kernel = 2
+    };
+
+    // bgra writes 3 output channels followed by an opaque 0xff byte
+    blackLut(int inputChannels, int inputDepth, int outputChannels, bool bgra, int gridPoints);
+
+    int inputChannels() const { return inputs; }
+    int outputChannels() const { return outputs; }
+    int gridPoints() const { return grid; }
+    int nodes() const;
+    // node values are 16-bit (0-65535) in output channel order
+    void setNode(int node, const unsigned short *values);
+    void nodeInput(int node, unsigned short *values) const;
+
+    void apply(const void *src, void *dst, int pixels) const;
+    void apply(const void *src, void *dst, int pixels, Kernel kernel) const;
+    static Kernel bestKernel();
+
+private:
+    int inputs;
+    int depth;
+    int outputs;
+    bool pad;
+    int grid;
+    int strides[4];
+    std::vector<unsigned short> table;
+
+    void applyScalar(const unsigned char *src, unsigned char *dst, int pixels) const;
+    void applySSE41(const unsigned char *src, unsigned char *dst, int pixels) const;
+    void applyAVX2(const unsigned char *src, unsigned char *dst, int pixels) const;
+};
+
+#endif // BLACKLUT_H
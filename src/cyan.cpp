@@ -16,6 +16,8 @@
 */
 
 #include "cyan.h"
+#include "magentaprobe.h"
+#include "magentajpeg.h"
 #include <QCoreApplication>
 #include <QLabel>
 #include <QVBoxLayout>
@@ -28,6 +30,12 @@
 #include <QMessageBox>
 #include <QIcon>
 #include <QKeySequence>
+#include <QStatusBar>
+#include <QPainter>
+#include <QStyleOptionGraphicsItem>
+#include <QDateTime>
+#include <QDir>
+#include <QtConcurrentRun>
 
 CyanView::CyanView(QWidget* parent) : QGraphicsView(parent) {
 }
@@ -63,10 +71,453 @@ void CyanView::doZoom(double scaleX, double scaleY)
     scale(scaleX,scaleY);
 }
 
+CyanTiles::CyanTiles(QGraphicsItem *parent) : QGraphicsObject(parent)
+{
+    setFlag(QGraphicsItem::ItemUsesExtendedStyleOption);
+    connect(&tileWatcher, SIGNAL(finished()), this, SLOT(tilesReady()));
+    connect(&levelWatcher, SIGNAL(finished()), this, SLOT(levelsReady()));
+    tilesWanted = false;
+    tiles = new QCache<qint64, QImage>(CYAN_TILE_CACHE);
+    alternateTiles = new QCache<qint64, QImage>(CYAN_ALTERNATE_CACHE);
+    gamutTiles.setMaxCost(CYAN_GAMUT_CACHE);
+    coverageTiles.setMaxCost(CYAN_COVERAGE_CACHE);
+    coverageLimit = BLACK_COVERAGE_LIMIT;
+}
+
+CyanTiles::~CyanTiles()
+{
+    delete tiles;
+    delete alternateTiles;
+}
+
+QRectF CyanTiles::boundingRect() const
+{
+    return QRectF(0, 0, size.width(), size.height());
+}
+
+void CyanTiles::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget)
+{
+    Q_UNUSED(widget)
+    // the quick preview stands in for the tiles until the full result arrives
+    if (!quick.isNull()) {
+        painter->setRenderHint(QPainter::SmoothPixmapTransform);
+        painter->drawImage(boundingRect(), quick);
+        return;
+    }
+    int level = getLevelFor(option->levelOfDetailFromTransform(painter->worldTransform()));
+    blackImage image = getLevel(level);
+    if (image.isNull()) {
+        return;
+    }
+
+    // only the tiles inside the exposed (visible) area are converted, in the background
+    qreal factorX = (qreal)size.width()/image.width;
+    qreal factorY = (qreal)size.height()/image.height;
+    QRect area = getArea(level, option->exposedRect);
+    if (area.isEmpty()) {
+        return;
+    }
+    QList<CyanTileJob> jobs;
+    QList<CyanTileJob> masks;
+    for (int row = area.top()/CYAN_TILE_SIZE; row <= area.bottom()/CYAN_TILE_SIZE; ++row) {
+        for (int column = area.left()/CYAN_TILE_SIZE; column <= area.right()/CYAN_TILE_SIZE; ++column) {
+            QRect rect = tileRect(level, column, row);
+            QRectF target(rect.x()*factorX, rect.y()*factorY, rect.width()*factorX, rect.height()*factorY);
+            qint64 key = tileKey(level, column, row);
+            QImage *cached = tiles->object(key);
+            if (!cached) {
+                paintPlaceholder(painter, level, column, row, target);
+                if (jobs.size() < CYAN_TILE_BATCH) {
+                    CyanTileJob job;
+                    job.key = key;
+                    job.level = image;
+                    job.rect = rect;
+                    job.transform = transform;
+                    job.cancel = sourceCancel;
+                    jobs << job;
+                }
+                continue;
+            }
+            painter->drawImage(target, *cached);
+            // masks are only drawn once made, the tiles themselves go first
+            if (gamut) {
+                QImage *mask = gamutTiles.object(key);
+                if (mask) {
+                    painter->drawImage(target, *mask);
+                } else if (masks.size() < CYAN_TILE_BATCH) {
+                    CyanTileJob job;
+                    job.kind = CYAN_TILE_GAMUT;
+                    job.key = key;
+                    job.level = image;
+                    job.rect = rect;
+                    job.transform = gamut;
+                    job.cancel = sourceCancel;
+                    masks << job;
+                }
+            }
+            if (coverage) {
+                QImage *heat = coverageTiles.object(key);
+                if (heat) {
+                    painter->drawImage(target, *heat);
+                } else if (masks.size() < CYAN_TILE_BATCH) {
+                    CyanTileJob job;
+                    job.kind = CYAN_TILE_COVERAGE;
+                    job.key = key;
+                    job.level = image;
+                    job.rect = rect;
+                    job.transform = coverage;
+                    job.limit = coverageLimit;
+                    job.cancel = sourceCancel;
+                    masks << job;
+                }
+            }
+        }
+    }
+    if (jobs.isEmpty()) {
+        jobs = masks;
+    }
+    requestTiles(jobs);
+}
+
+void CyanTiles::setSource(blackImage image, blackTransform display, QList<blackImage> pyramid, QSize full, blackCancel cancel)
+{
+    QSize bounds = full.isValid()?full:QSize(image.width, image.height);
+    if (bounds != size) {
+        prepareGeometryChange();
+    }
+    size = bounds;
+    quick = QImage();
+    // the pyramid only depends on the pixels, keep it when just the transform changed
+    if (image.pixels.constData() != source.pixels.constData() || image.width != source.width || image.height != source.height) {
+        levels.clear();
+        gamutTiles.clear();
+        coverageTiles.clear();
+    }
+    if (!pyramid.isEmpty() && pyramid.first().pixels.constData() == image.pixels.constData()) {
+        levels = pyramid;
+    }
+    source = image;
+    sourceCancel = cancel;
+    transform = display;
+    alternate.clear();
+    tiles->clear();
+    alternateTiles->clear();
+    requestLevels();
+    update();
+}
+
+void CyanTiles::setQuick(QImage image, int width, int height)
+{
+    // the tiles of the previous transform are stale from here on
+    if (QSize(width, height) != size) {
+        prepareGeometryChange();
+    }
+    quick = image;
+    backdrop = image;
+    size = QSize(width, height);
+    alternate.clear();
+    tiles->clear();
+    alternateTiles->clear();
+    update();
+}
+
+void CyanTiles::setGamut(blackTransform mask)
+{
+    if (mask != gamut) {
+        gamut = mask;
+        gamutTiles.clear();
+        update();
+    }
+}
+
+void CyanTiles::setCoverage(blackTransform ink, int limit)
+{
+    if (ink != coverage || limit != coverageLimit) {
+        coverage = ink;
+        coverageLimit = limit;
+        coverageTiles.clear();
+        update();
+    }
+}
+
+void CyanTiles::setAlternate(blackTransform display)
+{
+    alternate = display;
+    alternateTiles->clear();
+}
+
+bool CyanTiles::swapAlternate()
+{
+    if (!alternate || !quick.isNull()) {
+        return false;
+    }
+    qSwap(transform, alternate);
+    qSwap(tiles, alternateTiles);
+    // both caches keep their own budget
+    tiles->setMaxCost(CYAN_TILE_CACHE);
+    alternateTiles->setMaxCost(CYAN_ALTERNATE_CACHE);
+    update();
+    return true;
+}
+
+QList<CyanTileJob> CyanTiles::alternateJobs(QRectF visible, qreal scale)
+{
+    QList<CyanTileJob> jobs;
+    if (!alternate || !quick.isNull()) {
+        return jobs;
+    }
+    int level = getLevelFor(scale);
+    blackImage image = getLevel(level);
+    QRect area = getArea(level, visible);
+    if (image.isNull() || area.isEmpty()) {
+        return jobs;
+    }
+    int cost = 0;
+    for (int row = area.top()/CYAN_TILE_SIZE; row <= area.bottom()/CYAN_TILE_SIZE; ++row) {
+        for (int column = area.left()/CYAN_TILE_SIZE; column <= area.right()/CYAN_TILE_SIZE; ++column) {
+            CyanTileJob job;
+            job.key = tileKey(level, column, row);
+            if (alternateTiles->contains(job.key)) {
+                continue;
+            }
+            // tiles past the budget are left for on demand conversion
+            cost += CYAN_TILE_SIZE*CYAN_TILE_SIZE*4/1024;
+            if (cost > CYAN_ALTERNATE_CACHE) {
+                return jobs;
+            }
+            job.level = image;
+            job.rect = tileRect(level, column, row);
+            job.transform = alternate;
+            job.cancel = sourceCancel;
+            jobs << job;
+        }
+    }
+    return jobs;
+}
+
+int CyanTiles::addTiles(QList<CyanTileJob> jobs)
+{
+    // the toggle may have swapped the caches since the jobs were made, and jobs of a
+    // superseded preview read as cancelled
+    int added = 0;
+    int converted = 0;
+    qint64 usec = 0;
+    qint64 bytes = 0;
+    for (int i = 0; i < jobs.size(); ++i) {
+        const CyanTileJob &job = jobs.at(i);
+        QCache<qint64, QImage> *cache = 0;
+        if (job.kind == CYAN_TILE_GAMUT) {
+            // a mask of a replaced gamut transform or ink limit is dropped
+            if (job.transform == gamut) {
+                cache = &gamutTiles;
+            }
+        } else if (job.kind == CYAN_TILE_COVERAGE) {
+            if (job.transform == coverage && job.limit == coverageLimit) {
+                cache = &coverageTiles;
+            }
+        } else if (job.transform == alternate) {
+            cache = alternateTiles;
+        } else if (job.transform == transform) {
+            cache = tiles;
+        }
+        if (cache && !job.tile.isNull() && !job.cancel.cancelled() && !cache->contains(job.key)) {
+            cache->insert(job.key, new QImage(job.tile), qMax(1, job.tile.bytesPerLine()*job.tile.height()/1024));
+            added++;
+            if (job.kind == CYAN_TILE_DISPLAY) {
+                converted++;
+                usec += job.usec;
+                bytes += job.tile.bytesPerLine()*job.tile.height();
+            }
+        }
+    }
+    if (converted > 0) {
+        emit tilesConverted(converted, usec, bytes);
+    }
+    return added;
+}
+
+QList<CyanTileJob> CyanTiles::renderTiles(QList<CyanTileJob> jobs)
+{
+    // each tile is already split over the Black pool, one tile at a time here
+    Black black;
+    for (int i = 0; i < jobs.size() && !jobs.at(i).cancel.cancelled(); ++i) {
+        QElapsedTimer timer;
+        timer.start();
+        CyanTileJob job = jobs.at(i);
+        if (job.kind == CYAN_TILE_GAMUT) {
+            jobs[i].tile = black.gamutImage(job.level, job.transform, job.rect, job.cancel);
+        } else if (job.kind == CYAN_TILE_COVERAGE) {
+            jobs[i].tile = black.coverageImage(job.level, job.transform, job.rect, job.limit, job.cancel);
+        } else {
+            jobs[i].tile = black.displayImage(job.level, job.transform, job.rect, job.cancel);
+        }
+        jobs[i].usec = timer.nsecsElapsed()/1000;
+    }
+    return jobs;
+}
+
+QList<blackImage> CyanTiles::buildLevels(QList<blackImage> levels, blackCancel cancel)
+{
+    // the levels Magenta did not finish, a cancelled run keeps what it has
+    Black black;
+    while (!levels.isEmpty() && levels.size() <= CYAN_TILE_LEVELS && !cancel.cancelled()) {
+        blackImage half = black.halfImage(levels.last(), cancel);
+        if (half.isNull()) {
+            break;
+        }
+        levels << half;
+    }
+    return levels;
+}
+
+void CyanTiles::tilesReady()
+{
+    // paint asks for the next batch, unless nothing came of this one and nothing
+    // was turned away while it ran
+    if (addTiles(tileWatcher.result()) > 0 || tilesWanted) {
+        tilesWanted = false;
+        update();
+    }
+}
+
+void CyanTiles::levelsReady()
+{
+    QList<blackImage> made = levelWatcher.result();
+    if (!made.isEmpty() && made.first().pixels.constData() == source.pixels.constData() && made.size() > levels.size()) {
+        levels = made;
+        update();
+    }
+}
+
+void CyanTiles::requestTiles(QList<CyanTileJob> jobs)
+{
+    if (jobs.isEmpty()) {
+        return;
+    }
+    if (tileWatcher.isRunning()) {
+        tilesWanted = true;
+        return;
+    }
+    tileWatcher.setFuture(QtConcurrent::run(CyanTiles::renderTiles, jobs));
+}
+
+void CyanTiles::requestLevels()
+{
+    if (source.isNull() || levelWatcher.isRunning() || levels.size() > CYAN_TILE_LEVELS) {
+        return;
+    }
+    QList<blackImage> made = levels;
+    if (made.isEmpty()) {
+        made << source;
+    }
+    levelWatcher.setFuture(QtConcurrent::run(CyanTiles::buildLevels, made, sourceCancel));
+}
+
+blackTransform CyanTiles::gamutTransform(blackImage image, QList<QByteArray> profiles, int intent, bool black)
+{
+    // slow the first time (sampling both profiles), a cache hit after that
+    Black cms;
+    return cms.gamutTransform(image, profiles, intent, black);
+}
+
+CyanCoverage CyanTiles::inkCoverage(blackImage image, QList<QByteArray> profiles, magentaAdjust edit, CyanCoverage previous, blackCancel cancel)
+{
+    // the statistics only change with the pixels or the output transform, a limit
+    // change is read from the histogram
+    Black cms;
+    CyanCoverage result;
+    result.image = image;
+    result.transform = cms.coverageTransform(image, profiles, edit.intent, edit.black);
+    if (!result.transform) {
+        return result;
+    }
+    if (result.transform == previous.transform && image.pixels.constData() == previous.image.pixels.constData() && !previous.stats.histogram.isEmpty()) {
+        return previous;
+    }
+    result.stats = cms.inkCoverage(image, result.transform, cancel);
+    return result;
+}
+
+int CyanTiles::getLevelFor(qreal scale)
+{
+    // the smallest pyramid level that still has at least one pixel per screen pixel
+    if (source.width > 0) {
+        // a reduced decode already counts as a smaller level
+        scale *= (qreal)size.width()/source.width;
+    }
+    int level = 0;
+    while (scale <= 0.5 && level < CYAN_TILE_LEVELS && !getLevel(level+1).isNull()) {
+        scale *= 2;
+        level++;
+    }
+    return level;
+}
+
+QRect CyanTiles::getArea(int level, QRectF exposed)
+{
+    blackImage image = getLevel(level);
+    if (image.isNull()) {
+        return QRect();
+    }
+    qreal factorX = (qreal)size.width()/image.width;
+    qreal factorY = (qreal)size.height()/image.height;
+    exposed &= boundingRect();
+    return QRectF(exposed.x()/factorX, exposed.y()/factorY, exposed.width()/factorX, exposed.height()/factorY).toAlignedRect() & QRect(0, 0, image.width, image.height);
+}
+
+blackImage CyanTiles::getLevel(int level)
+{
+    // levels still being made (see requestLevels) are null
+    if (level == 0) {
+        return source;
+    }
+    if (level < levels.size()) {
+        return levels.at(level);
+    }
+    return blackImage();
+}
+
+QRect CyanTiles::tileRect(int level, int column, int row)
+{
+    blackImage image = getLevel(level);
+    return QRect(column*CYAN_TILE_SIZE, row*CYAN_TILE_SIZE, CYAN_TILE_SIZE, CYAN_TILE_SIZE) & QRect(0, 0, image.width, image.height);
+}
+
+void CyanTiles::paintPlaceholder(QPainter *painter, int level, int column, int row, QRectF target)
+{
+    // a cached tile of a coarser level, else the quick preview, clipped to the missing tile
+    painter->save();
+    painter->setClipRect(target, Qt::IntersectClip);
+    for (int coarse = level+1; coarse <= CYAN_TILE_LEVELS; ++coarse) {
+        int shift = coarse-level;
+        QImage *cached = tiles->object(tileKey(coarse, column>>shift, row>>shift));
+        blackImage image = getLevel(coarse);
+        if (cached && !image.isNull()) {
+            qreal factorX = (qreal)size.width()/image.width;
+            qreal factorY = (qreal)size.height()/image.height;
+            QRect rect = tileRect(coarse, column>>shift, row>>shift);
+            painter->drawImage(QRectF(rect.x()*factorX, rect.y()*factorY, rect.width()*factorX, rect.height()*factorY), *cached);
+            painter->restore();
+            return;
+        }
+    }
+    if (!backdrop.isNull()) {
+        painter->setRenderHint(QPainter::SmoothPixmapTransform);
+        painter->drawImage(boundingRect(), backdrop);
+    }
+    painter->restore();
+}
+
+qint64 CyanTiles::tileKey(int level, int column, int row)
+{
+    return ((qint64)level << 56) | ((qint64)row << 28) | column;
+}
+
 Cyan::Cyan(QWidget *parent)
     : QMainWindow(parent)
     , scene(0)
     , view(0)
+    , tiles(0)
     , mainBar(0)
     , convertBar(0)
     , profileBar(0)
@@ -86,11 +537,22 @@ Cyan::Cyan(QWidget *parent)
     , openImageAction(0)
     , saveImageAction(0)
     , quitAction(0)
-    , currentImageData(0)
+    , currentImageScale(1)
     , currentImageProfile(0)
     , currentImageNewProfile(0)
     , monitorCheckBox(0)
+    , gamutCheckBox(0)
+    , alternateGeneration(0)
+    , coverageCheckBox(0)
+    , coverageLimit(0)
+    , coverageLabel(0)
+    , coverageTicket(0)
     , exportEmbeddedProfileAction(0)
+    , exportDeviceLinkAction(0)
+    , logTimingsAction(0)
+    , tileCount(0)
+    , tileUsec(0)
+    , tileBytes(0)
 {
     setWindowTitle(qApp->applicationName());
     setWindowIcon(QIcon(":/cyan.png"));
@@ -150,6 +612,8 @@ Cyan::Cyan(QWidget *parent)
     QLabel *monitorLabel = new QLabel();
     QLabel *renderLabel = new QLabel();
     QLabel *blackLabel = new QLabel();
+    QLabel *gamutLabel = new QLabel();
+    QLabel *coverageTitle = new QLabel();
     QLabel *rgbLabel = new QLabel();
     QLabel *cmykLabel = new QLabel();
     QLabel *grayLabel = new QLabel();
@@ -159,6 +623,8 @@ Cyan::Cyan(QWidget *parent)
     monitorLabel->setText(tr("Monitor"));
     renderLabel->setText(tr("Intent"));
     blackLabel->setText(tr("Black Point"));
+    gamutLabel->setText(tr("Gamut"));
+    coverageTitle->setText(tr("TAC"));
     rgbLabel->setText(tr("RGB"));
     cmykLabel->setText(tr("CMYK"));
     grayLabel->setText(tr("GRAY"));
@@ -168,12 +634,26 @@ Cyan::Cyan(QWidget *parent)
     monitorLabel->setToolTip(tr("Monitor profile, used for proofing"));
     renderLabel->setToolTip(tr("Rendering intent used"));
     blackLabel->setToolTip(tr("Enable/Disable black point compensation"));
+    gamutLabel->setToolTip(tr("Mark colors outside the output profile gamut in green"));
+    coverageTitle->setToolTip(tr("Show the total ink coverage of a CMYK output as a heat map"));
     rgbLabel->setToolTip(tr("Default RGB profile, used when image don't have an embedded profile"));
     cmykLabel->setToolTip(tr("Default CMYK profile, used when image don't have an embedded profile"));
     grayLabel->setToolTip(tr("Default GRAY profile, used when image don't have an embedded profile"));
 
     monitorCheckBox = new QCheckBox();
     monitorCheckBox->setToolTip(tr("Enable/Disable proofing"));
+    gamutCheckBox = new QCheckBox();
+    gamutCheckBox->setToolTip(tr("Enable/Disable gamut check"));
+    coverageCheckBox = new QCheckBox();
+    coverageCheckBox->setToolTip(tr("Enable/Disable total area coverage (TAC) check"));
+    coverageLimit = new QSpinBox();
+    coverageLimit->setRange(100, 400);
+    coverageLimit->setSingleStep(10);
+    coverageLimit->setSuffix("%");
+    coverageLimit->setValue(BLACK_COVERAGE_LIMIT);
+    coverageLimit->setToolTip(tr("Ink limit, total area coverage above it is shown in red"));
+    coverageLabel = new QLabel();
+    statusBar()->addPermanentWidget(coverageLabel);
 
     convertBar->addWidget(inputLabel);
     convertBar->addWidget(inputProfile);
@@ -184,6 +664,13 @@ Cyan::Cyan(QWidget *parent)
     convertBar->addWidget(monitorLabel);
     convertBar->addWidget(monitorProfile);
     convertBar->addWidget(monitorCheckBox);
+    convertBar->addSeparator();
+    convertBar->addWidget(gamutLabel);
+    convertBar->addWidget(gamutCheckBox);
+    convertBar->addSeparator();
+    convertBar->addWidget(coverageTitle);
+    convertBar->addWidget(coverageCheckBox);
+    convertBar->addWidget(coverageLimit);
 
     profileBar->addWidget(rgbLabel);
     profileBar->addWidget(rgbProfile);
@@ -246,6 +733,17 @@ Cyan::Cyan(QWidget *parent)
     exportEmbeddedProfileAction->setDisabled(true);
     fileMenu->addAction(exportEmbeddedProfileAction);
 
+    exportDeviceLinkAction = new QAction(tr("Export device link"), this);
+    exportDeviceLinkAction->setIcon(QIcon(":/cyan-save.png"));
+    exportDeviceLinkAction->setStatusTip(tr("Save the input and output profiles, intent and black point compensation as one device link profile"));
+    exportDeviceLinkAction->setDisabled(true);
+    fileMenu->addAction(exportDeviceLinkAction);
+
+    logTimingsAction = new QAction(tr("Log timings"), this);
+    logTimingsAction->setCheckable(true);
+    logTimingsAction->setStatusTip(tr("Append the timings of every request to %1").arg(QDir::toNativeSeparators(timingsLogFile())));
+    fileMenu->addAction(logTimingsAction);
+
     fileMenu->addSeparator();
 
     quitAction = new QAction(tr("Quit"),this);
@@ -255,6 +753,7 @@ Cyan::Cyan(QWidget *parent)
 
     qRegisterMetaType<magentaImage>("magentaImage");
     qRegisterMetaType<magentaAdjust>("magentaAdjust");
+    qRegisterMetaType<magentaSource>("magentaSource");
 
     connect(&proc, SIGNAL(returnImage(magentaImage)), this, SLOT(getImage(magentaImage)));
 
@@ -265,6 +764,7 @@ Cyan::Cyan(QWidget *parent)
     connect(mainBarLoadButton, SIGNAL(released()), this, SLOT(openImageDialog()));
     connect(mainBarSaveButton, SIGNAL(released()), this, SLOT(saveImageDialog()));
     connect(exportEmbeddedProfileAction, SIGNAL(triggered()), this, SLOT(exportEmbeddedProfileDialog()));
+    connect(exportDeviceLinkAction, SIGNAL(triggered()), this, SLOT(exportDeviceLinkDialog()));
     connect(quitAction, SIGNAL(triggered()), qApp, SLOT(quit()));
 
     connect(rgbProfile, SIGNAL(currentIndexChanged(int)), this, SLOT(updateRgbDefaultProfile(int)));
@@ -275,8 +775,20 @@ Cyan::Cyan(QWidget *parent)
     connect(inputProfile, SIGNAL(currentIndexChanged(int)), this, SLOT(inputProfileChanged(int)));
     connect(outputProfile, SIGNAL(currentIndexChanged(int)), this, SLOT(outputProfileChanged(int)));
     connect(monitorCheckBox, SIGNAL(toggled(bool)), this, SLOT(monitorCheckBoxChanged(bool)));
+    connect(gamutCheckBox, SIGNAL(toggled(bool)), this, SLOT(gamutCheckBoxChanged(bool)));
+    connect(&alternateWatcher, SIGNAL(finished()), this, SLOT(alternateTilesReady()));
+    connect(&gamutWatcher, SIGNAL(finished()), this, SLOT(gamutReady()));
+    connect(coverageCheckBox, SIGNAL(toggled(bool)), this, SLOT(updateCoverage()));
+    connect(coverageLimit, SIGNAL(valueChanged(int)), this, SLOT(coverageLimitChanged(int)));
+    connect(&coverageWatcher, SIGNAL(finished()), this, SLOT(coverageReady()));
+    tileTimer.setSingleShot(true);
+    tileTimer.setInterval(CYAN_TILE_REPORT);
+    connect(&tileTimer, SIGNAL(timeout()), this, SLOT(showTileTimings()));
+    cacheReported = Black::cacheStats();
 
     connect(view, SIGNAL(resetZoom()), this, SLOT(resetImageZoom()));
+    connect(view, SIGNAL(resetZoom()), this, SLOT(imageZoomChanged()));
+    connect(view, SIGNAL(myZoom(double,double)), this, SLOT(imageZoomChanged()));
     connect(view, SIGNAL(proof()), this, SLOT(triggerMonitor()));
 
     //setStyleSheet("QLabel {margin-left:10px;}");
@@ -295,12 +807,26 @@ void Cyan::readConfig()
 
     settings.beginGroup("color");
     monitorCheckBox->setChecked(settings.value("proof").toBool());
+    gamutCheckBox->setChecked(settings.value("gamut").toBool());
+    coverageCheckBox->setChecked(settings.value("coverage").toBool());
+    if (settings.value("coverageLimit").isValid()) {
+        coverageLimit->setValue(settings.value("coverageLimit").toInt());
+    }
     blackPoint->setChecked(settings.value("black").toBool());
     if (settings.value("render").isValid()) {
         renderingIntent->setCurrentIndex(settings.value("render").toInt());
     }
     settings.endGroup();
 
+    settings.beginGroup("cache");
+    Black::setCacheLimit(settings.value("transforms", 64).toLongLong()*1024*1024);
+    settings.endGroup();
+
+    settings.beginGroup("performance");
+    Black::setThreads(settings.value("threads", 0).toInt());
+    logTimingsAction->setChecked(settings.value("log", false).toBool());
+    settings.endGroup();
+
     settings.beginGroup("ui");
     if (settings.value("state").isValid()) {
         restoreState(settings.value("state").toByteArray());
@@ -317,11 +843,12 @@ void Cyan::readConfig()
     settings.endGroup();
 
     loadDefaultProfiles();
+    showProfileTimings();
 
     QStringList args = qApp->arguments();
     for (int i = 1; i < args.size(); ++i) {
         QString file = args.at(i);
-        if (!file.isEmpty()) {
+        if (!file.isEmpty() && !file.startsWith("--")) {
             openImage(file);
             break;
         }
@@ -334,10 +861,21 @@ void Cyan::writeConfig()
 
     settings.beginGroup("color");
     settings.setValue("proof", monitorCheckBox->isChecked());
+    settings.setValue("gamut", gamutCheckBox->isChecked());
+    settings.setValue("coverage", coverageCheckBox->isChecked());
+    settings.setValue("coverageLimit", coverageLimit->value());
     settings.setValue("black", blackPoint->isChecked());
     settings.setValue("render", renderingIntent->itemData(renderingIntent->currentIndex()).toInt());
     settings.endGroup();
 
+    settings.beginGroup("cache");
+    settings.setValue("transforms", Black::cacheStats().limit/1024/1024);
+    settings.endGroup();
+
+    settings.beginGroup("performance");
+    settings.setValue("log", logTimingsAction->isChecked());
+    settings.endGroup();
+
     settings.beginGroup("ui");
     settings.setValue( "state", saveState());
     settings.setValue("size", size());
@@ -433,14 +971,26 @@ void Cyan::openImage(QString file)
 {
     if (!file.isEmpty()) {
         disableUI();
+        // the headers are enough for the title and the profile lists, the pixels follow from Magenta
+        magentaInfo info = magentaProbe::probe(file);
         QByteArray empty;
         magentaAdjust adjust;
+        if (info.isValid()) {
+            imageClear();
+            probedImageFile = file;
+            currentImageProfile = info.profile.isEmpty()?cms.profileDefault(info.colorspace):info.profile;
+            setImageTitle(file, info.colorspace, info.width, info.height);
+            getConvertProfiles();
+            // lets Magenta decode a JPEG at the reduced size the view needs
+            adjust.zoom = fitImageZoom(info.width, info.height);
+        }
         adjust.black = false;
         adjust.brightness = 100;
         adjust.hue = 100;
         adjust.intent = 0;
         adjust.saturation = 100;
-        proc.requestImage(false , false, file, empty, empty, empty, empty, adjust);
+        // only the mapping handle crosses to the Magenta thread
+        proc.requestImage(false , false, file, Magenta::mapSource(file), empty, empty, empty, adjust);
     }
 }
 
@@ -462,7 +1012,7 @@ void Cyan::saveImage(QString file)
         } else {
             currentInputProfile = currentImageProfile;
         }
-        proc.requestImage(false , true, file, currentImageData, currentInputProfile, getOutputProfile(), empty, adjust);
+        proc.requestImage(false , true, file, magentaSource(), currentInputProfile, getOutputProfile(), empty, adjust);
     }
 }
 
@@ -599,11 +1149,39 @@ void Cyan::updateMonitorDefaultProfile(int index)
 
     if (monitorCheckBox->isChecked()) {
         updateImage();
+    } else {
+        // the prepared proof side was built with the previous monitor profile
+        alternateGeneration = 0;
     }
 }
 
 void Cyan::getImage(magentaImage result)
 {
+    if (result.preview && result.generation != proc.currentGeneration()) {
+        return;
+    }
+    if (result.preview && result.job == "alternate") {
+        // converted for the other proof state while the preview was shown
+        if (tiles && result.transform) {
+            tiles->setAlternate(result.transform);
+            alternateGeneration = result.generation;
+            alternateWatcher.setFuture(QtConcurrent::run(CyanTiles::renderTiles, tiles->alternateJobs(view->mapToScene(view->viewport()->rect()).boundingRect(), view->matrix().m11())));
+        }
+        return;
+    }
+    if (result.preview && !result.quick.isNull()) {
+        // first pass of a preview, the full result follows
+        QElapsedTimer timer;
+        timer.start();
+        setQuickImage(result.quick, result.width, result.height);
+        magentaTiming timing;
+        timing.stage = "display";
+        timing.usec = timer.nsecsElapsed()/1000;
+        timing.bytes = 0;
+        result.timings << timing;
+        showTimings(result);
+        return;
+    }
     enableUI();
     if (result.saved && result.error.isEmpty() && result.warning.isEmpty()) {
         QFileInfo imageFile(result.filename);
@@ -613,31 +1191,34 @@ void Cyan::getImage(magentaImage result)
             QMessageBox::warning(this, tr("Failed to save image"), tr("Failed to save image to disk"));
         }
     }
-    if (result.error.isEmpty() && result.warning.isEmpty() && result.data.length() > 0 && result.profile.length() > 0) {
+    if (result.error.isEmpty() && result.warning.isEmpty() && (!result.preview || !result.source.isNull()) && result.profile.length() > 0) {
         if (!result.preview) {
-            imageClear();
-            currentImageData = result.data;
-            currentImageProfile = result.profile;
-            QFileInfo imageFile(result.filename);
-            QString imageColorspace;
-            switch (result.colorspace) {
-            case 1:
-                imageColorspace = "RGB";
-                break;
-            case 2:
-                imageColorspace = "CMYK";
-                break;
-            case 3:
-                imageColorspace = "GRAY";
-                break;
+            // already set up by openImage when the headers agree with the decoded image
+            if (probedImageFile != result.filename || currentImageProfile != result.profile) {
+                imageClear();
+                currentImageProfile = result.profile;
+                setImageTitle(result.filename, result.colorspace, result.width, result.height);
+                getConvertProfiles();
+                fitImageZoom(result.width, result.height);
             }
-            QString newWindowTitle = qApp->applicationName() + " - " + imageFile.fileName() + " [ " + imageColorspace+" ]" + " [ " + cms.profileDescFromData(currentImageProfile) + " ] [ " + QString::number(result.width) + "x" + QString::number(result.height) + " ]";
-            setWindowTitle(newWindowTitle);
-            getConvertProfiles();
+            probedImageFile.clear();
+            currentImageFile = result.filename;
+            currentImageScale = result.scale;
             exportEmbeddedProfileAction->setEnabled(true);
+            exportDeviceLinkAction->setEnabled(true);
             updateImage();
         } else {
-            setImage(result.data);
+            QElapsedTimer timer;
+            timer.start();
+            setImage(result.source, result.transform, result.levels, result.width, result.height, proc.generationCancel(result.generation));
+            currentImageScale = result.scale;
+            updateGamut();
+            updateCoverage();
+            magentaTiming timing;
+            timing.stage = "display";
+            timing.usec = timer.nsecsElapsed()/1000;
+            timing.bytes = 0;
+            result.timings << timing;
         }
     } else {
         if (!result.error.isEmpty()) {
@@ -648,21 +1229,47 @@ void Cyan::getImage(magentaImage result)
         }
         if (!result.saved) {
             imageClear();
+            probedImageFile.clear();
         }
     }
+    showTimings(result);
+}
+
+void Cyan::setImageTitle(QString file, int colorspace, int width, int height)
+{
+    QFileInfo imageFile(file);
+    QString imageColorspace;
+    switch (colorspace) {
+    case 1:
+        imageColorspace = "RGB";
+        break;
+    case 2:
+        imageColorspace = "CMYK";
+        break;
+    case 3:
+        imageColorspace = "GRAY";
+        break;
+    }
+    QString newWindowTitle = qApp->applicationName() + " - " + imageFile.fileName() + " [ " + imageColorspace+" ]" + " [ " + cms.profileDescFromData(currentImageProfile) + " ] [ " + QString::number(width) + "x" + QString::number(height) + " ]";
+    setWindowTitle(newWindowTitle);
 }
 
 void Cyan::imageClear()
 {
     setWindowTitle(qApp->applicationName());
-    currentImageData.clear();
+    currentImageFile.clear();
     currentImageProfile.clear();
     currentImageNewProfile.clear();
     scene->clear();
+    tiles = 0;
+    currentCoverage = CyanCoverage();
+    coverageLabel->clear();
+    statusBar()->clearMessage();
     resetImageZoom();
     mainBarSaveButton->setDisabled(true);
     saveImageAction->setDisabled(true);
     exportEmbeddedProfileAction->setDisabled(true);
+    exportDeviceLinkAction->setDisabled(true);
 }
 
 void Cyan::resetImageZoom()
@@ -672,28 +1279,68 @@ void Cyan::resetImageZoom()
     view->setMatrix(matrix);
 }
 
-void Cyan::setImage(QByteArray image)
+double Cyan::fitImageZoom(int width, int height)
+{
+    // new images start fitted to the window, never enlarged
+    double zoom = 1.0;
+    if (width > 0 && height > 0) {
+        zoom = qMin(1.0, qMin((double)view->viewport()->width()/width, (double)view->viewport()->height()/height));
+    }
+    QMatrix matrix;
+    matrix.scale(zoom, zoom);
+    view->setMatrix(matrix);
+    return zoom;
+}
+
+void Cyan::imageZoomChanged()
+{
+    // a reduced decode is refined once the view gets closer than it can show
+    if (currentImageScale > 1 && magentaJpeg::scaleFor(view->matrix().m11()) < currentImageScale) {
+        updateImage();
+    }
+}
+
+void Cyan::setImage(blackImage source, blackTransform transform, QList<blackImage> levels, int width, int height, blackCancel cancel)
 {
-    if (image.length() > 0) {
-        QPixmap pixmap(QPixmap::fromImage(QImage::fromData(image)));
-        if (!pixmap.isNull()) {
+    if (!source.isNull()) {
+        if (!tiles) {
             scene->clear();
-            scene->addPixmap(pixmap);
-            scene->setSceneRect(0, 0, pixmap.width(), pixmap.height());
+            tiles = new CyanTiles();
+            connect(tiles, SIGNAL(tilesConverted(int,qint64,qint64)), this, SLOT(addTileTimings(int,qint64,qint64)));
+            scene->addItem(tiles);
         }
+        tiles->setSource(source, transform, levels, QSize(width, height), cancel);
+        scene->setSceneRect(0, 0, width, height);
+    }
+}
+
+void Cyan::setQuickImage(QImage image, int width, int height)
+{
+    if (!image.isNull() && width > 0 && height > 0) {
+        if (!tiles) {
+            scene->clear();
+            tiles = new CyanTiles();
+            connect(tiles, SIGNAL(tilesConverted(int,qint64,qint64)), this, SLOT(addTileTimings(int,qint64,qint64)));
+            scene->addItem(tiles);
+        }
+        tiles->setQuick(image, width, height);
+        scene->setSceneRect(0, 0, width, height);
     }
 }
 
 void Cyan::updateImage()
 {
-    if (currentImageData.length() > 0 && currentImageProfile.length() > 0) {
-        disableUI();
+    if (!currentImageFile.isEmpty() && currentImageProfile.length() > 0) {
         magentaAdjust adjust;
         adjust.black = blackPoint->isChecked();
         adjust.brightness = 100;
         adjust.hue = 100;
         adjust.intent = renderingIntent->itemData(renderingIntent->currentIndex()).toInt();
         adjust.saturation = 100;
+        adjust.preview = qMax(view->viewport()->width(), view->viewport()->height());
+        adjust.zoom = view->matrix().m11();
+        // Magenta never goes back to a smaller decode, so neither does the request
+        currentImageScale = qMin(currentImageScale, magentaJpeg::scaleFor(adjust.zoom));
         QByteArray currentInputProfile;
         QString selectedInputProfile = inputProfile->itemData(inputProfile->currentIndex()).toString();
         if (!selectedInputProfile.isEmpty()) {
@@ -701,11 +1348,10 @@ void Cyan::updateImage()
         } else {
             currentInputProfile = currentImageProfile;
         }
-        QByteArray proof;
-        if (monitorCheckBox->isChecked()) {
-            proof = getMonitorProfile();
-        }
-        proc.requestImage(true, false, "", currentImageData, currentInputProfile, getOutputProfile(), proof, adjust);
+        // the monitor profile always goes along, Magenta also builds the other proof state
+        adjust.proof = monitorCheckBox->isChecked();
+        adjust.alternate = true;
+        proc.requestImage(true, false, "", magentaSource(), currentInputProfile, getOutputProfile(), getMonitorProfile(), adjust);
     }
 }
 
@@ -799,6 +1445,18 @@ void Cyan::getConvertProfiles()
                 outputProfile->addItem(itemIcon, desc, file);
             }
         }
+
+        // device links replace the input profile, intent and BPC
+        QStringList links = cms.genLinks(currentImageColorspace);
+        if (!links.isEmpty()) {
+            outputProfile->addItem("----------");
+        }
+        for (int i = 0; i < links.size(); ++i) {
+            QStringList profile = links.at(i).split("|");
+            if (profile.size() > 1 && !profile.at(0).isEmpty() && !profile.at(1).isEmpty()) {
+                outputProfile->addItem(itemIcon, profile.at(1) + tr(" (device link)"), profile.at(0));
+            }
+        }
     }
 }
 
@@ -831,15 +1489,137 @@ void Cyan::outputProfileChanged(int index)
         saveImageAction->setEnabled(true);
         mainBarSaveButton->setEnabled(true);
     }
+    // a device link already holds the input profile, intent and BPC
+    Black black;
+    bool link = black.isDeviceLink(getOutputProfile());
+    inputProfile->setDisabled(link);
+    renderingIntent->setDisabled(link);
+    blackPoint->setDisabled(link);
+    gamutCheckBox->setDisabled(link);
+    exportDeviceLinkAction->setDisabled(link || currentImageFile.isEmpty());
     updateImage();
 }
 
 void Cyan::monitorCheckBoxChanged(bool triggered)
 {
     Q_UNUSED(triggered)
+    // a swap when the other side is ready for the latest preview, else a new request
+    if (tiles && alternateGeneration == proc.currentGeneration() && tiles->swapAlternate()) {
+        return;
+    }
     updateImage();
 }
 
+void Cyan::gamutCheckBoxChanged(bool triggered)
+{
+    Q_UNUSED(triggered)
+    updateGamut();
+}
+
+void Cyan::alternateTilesReady()
+{
+    if (tiles) {
+        tiles->addTiles(alternateWatcher.result());
+    }
+}
+
+void Cyan::updateGamut()
+{
+    if (!tiles) {
+        return;
+    }
+    // only proofing previews (an output profile is selected) have a gamut to check,
+    // a device link has no output profile to check against
+    QByteArray outProfile = getOutputProfile();
+    Black black;
+    if (!gamutCheckBox->isChecked() || outProfile.isEmpty() || black.isDeviceLink(outProfile)) {
+        tiles->setGamut(blackTransform());
+        return;
+    }
+    blackImage image = tiles->getSource();
+    gamutFormat.colorspace = image.colorspace;
+    gamutFormat.depth = image.depth;
+    QList<QByteArray> profiles;
+    profiles << getInputProfile() << outProfile;
+    gamutWatcher.setFuture(QtConcurrent::run(CyanTiles::gamutTransform, image, profiles, renderingIntent->itemData(renderingIntent->currentIndex()).toInt(), blackPoint->isChecked()));
+}
+
+void Cyan::gamutReady()
+{
+    // the transform reads pixels in the format it was made for
+    if (tiles && gamutCheckBox->isChecked() && tiles->getSource().colorspace == gamutFormat.colorspace && tiles->getSource().depth == gamutFormat.depth) {
+        tiles->setGamut(gamutWatcher.result());
+    }
+}
+
+void Cyan::updateCoverage()
+{
+    // a new ticket stops the reduction still running for an older preview
+    int ticket = coverageTicket.fetchAndAddRelaxed(1)+1;
+    QByteArray outProfile = getOutputProfile();
+    if (!tiles || !coverageCheckBox->isChecked() || outProfile.isEmpty()) {
+        if (tiles) {
+            tiles->setCoverage(blackTransform(), coverageLimit->value());
+        }
+        coverageLabel->clear();
+        return;
+    }
+    QList<QByteArray> profiles;
+    Black black;
+    if (!black.isDeviceLink(outProfile)) {
+        profiles << getInputProfile();
+    }
+    profiles << outProfile;
+    magentaAdjust adjust;
+    adjust.intent = renderingIntent->itemData(renderingIntent->currentIndex()).toInt();
+    adjust.black = blackPoint->isChecked();
+    coverageWatcher.setFuture(QtConcurrent::run(CyanTiles::inkCoverage, tiles->getSource(), profiles, adjust, currentCoverage, blackCancel(&coverageTicket, ticket)));
+}
+
+void Cyan::coverageReady()
+{
+    CyanCoverage result = coverageWatcher.result();
+    if (!tiles || !coverageCheckBox->isChecked() || result.image.pixels.constData() != tiles->getSource().pixels.constData()) {
+        return;
+    }
+    if (!result.transform) {
+        // not a CMYK output
+        tiles->setCoverage(blackTransform(), coverageLimit->value());
+        coverageLabel->clear();
+        return;
+    }
+    if (result.stats.histogram.isEmpty()) {
+        return;
+    }
+    currentCoverage = result;
+    tiles->setCoverage(result.transform, coverageLimit->value());
+    showCoverage();
+}
+
+void Cyan::coverageLimitChanged(int limit)
+{
+    if (tiles && currentCoverage.transform && coverageCheckBox->isChecked()) {
+        tiles->setCoverage(currentCoverage.transform, limit);
+        showCoverage();
+    }
+}
+
+void Cyan::showCoverage()
+{
+    // "TAC max 342%, mean 187%, 2.4% over 300%", a reduced decode only gives an
+    // estimate until the full image is decoded
+    QString text = tr("TAC max %1%, mean %2%, %3% over %4%")
+                   .arg(currentCoverage.stats.max())
+                   .arg(QString::number(currentCoverage.stats.mean(), 'f', 0))
+                   .arg(QString::number(currentCoverage.stats.over(coverageLimit->value()), 'f', 1))
+                   .arg(coverageLimit->value());
+    int reduced = currentCoverage.image.width>0?qRound(tiles->boundingRect().width()/currentCoverage.image.width):1;
+    if (reduced > 1) {
+        text = tr("%1 (approx., 1/%2 size)").arg(text).arg(reduced);
+    }
+    coverageLabel->setText(text);
+}
+
 void Cyan::enableUI()
 {
     menuBar->setEnabled(true);
@@ -897,10 +1677,17 @@ void Cyan::exportEmbeddedProfileDialog()
 
 void Cyan::exportEmbeddedProfile(QString file)
 {
-    if (!file.isEmpty() && currentImageProfile.length() > 0) {
+    if (file.isEmpty() || currentImageFile.isEmpty()) {
+        return;
+    }
+    // taken from the file headers, currentImageProfile is a default profile when nothing is embedded
+    QByteArray embeddedProfile = magentaProbe::probe(currentImageFile).profile;
+    if (embeddedProfile.isEmpty()) {
+        QMessageBox::warning(this, tr("Unable to save profile"), tr("The image has no embedded color profile."));
+    } else {
         QFile proFile(file);
         if (proFile.open(QIODevice::WriteOnly)) {
-            if (proFile.write(currentImageProfile) == -1) {
+            if (proFile.write(embeddedProfile) == -1) {
                 QMessageBox::warning(this, tr("Unable to save profile"), tr("Unable to save profile, please check write permissions."));
             } else {
                 QFileInfo proFileInfo(file);
@@ -912,3 +1699,232 @@ void Cyan::exportEmbeddedProfile(QString file)
         }
     }
 }
+
+void Cyan::exportDeviceLinkDialog()
+{
+    if (getOutputProfile().isEmpty()) {
+        QMessageBox::warning(this, tr("Unable to save device link"), tr("Select an output profile first."));
+        return;
+    }
+    Black black;
+    if (black.isDeviceLink(getOutputProfile())) {
+        QMessageBox::warning(this, tr("Unable to save device link"), tr("The output is already a device link."));
+        return;
+    }
+
+    QSettings settings;
+    settings.beginGroup("default");
+
+    QString file;
+    QString dir;
+
+    if (settings.value("lastSaveDir").isValid()) {
+        dir = settings.value("lastSaveDir").toString();
+    } else {
+        dir = QDir::homePath();
+    }
+
+    dir.append("/" + cms.profileDescFromData(getInputProfile()) + " to " + cms.profileDescFromData(getOutputProfile()) + ".icc");
+
+    file = QFileDialog::getSaveFileName(this, tr("Save device link"), dir, tr("Color Profiles (*.icc)"));
+    if (!file.isEmpty()) {
+        QFileInfo proFile(file);
+        if (proFile.suffix().isEmpty()) {
+            file.append(".icc");
+        }
+        exportDeviceLink(file);
+        settings.setValue("lastSaveDir", proFile.absoluteDir().absolutePath());
+    }
+
+    settings.endGroup();
+    settings.sync();
+}
+
+void Cyan::exportDeviceLink(QString file)
+{
+    if (file.isEmpty()) {
+        return;
+    }
+    // same chain, intent and BPC as saving the image
+    QList<QByteArray> profiles;
+    profiles << getInputProfile() << getOutputProfile();
+    QString error;
+    Black black;
+    QByteArray link = black.deviceLink(profiles, renderingIntent->itemData(renderingIntent->currentIndex()).toInt(), blackPoint->isChecked(), getDeviceLinkDescription(), &error);
+    if (link.isEmpty()) {
+        QMessageBox::warning(this, tr("Unable to save device link"), error);
+        return;
+    }
+    QFile proFile(file);
+    if (proFile.open(QIODevice::WriteOnly) && proFile.write(link) != -1) {
+        QFileInfo proFileInfo(file);
+        QMessageBox::information(this, tr("Device link saved"), proFileInfo.completeBaseName() + tr(" Saved to disk."));
+    } else {
+        QMessageBox::warning(this, tr("Unable to save device link"), tr("Unable to save profile, please check write permissions."));
+    }
+    proFile.close();
+}
+
+QByteArray Cyan::getInputProfile()
+{
+    QString selectedInputProfile = inputProfile->itemData(inputProfile->currentIndex()).toString();
+    if (!selectedInputProfile.isEmpty()) {
+        return currentImageNewProfile;
+    }
+    return currentImageProfile;
+}
+
+QString Cyan::getDeviceLinkDescription()
+{
+    // "sRGB to Coated FOGRA39, Perceptual, BPC"
+    QString description = cms.profileDescFromData(getInputProfile()) + " to " + cms.profileDescFromData(getOutputProfile()) + ", " + renderingIntent->currentText();
+    if (blackPoint->isChecked()) {
+        description.append(", BPC");
+    }
+    return description;
+}
+
+void Cyan::showTimings(magentaImage result)
+{
+    // "Preview: transform 3.1 ms, display 0.2 ms, total 3.3 ms | Working image uses 45.0 MB
+    // | Transforms: 2 hits, 0 misses, 0 evicted, 1.2 MB cached"
+    QStringList stages;
+    qint64 total = 0;
+    for (int i = 0; i < result.timings.size(); ++i) {
+        magentaTiming timing = result.timings.at(i);
+        QString stage = timing.stage + " " + QString::number(timing.usec/1000.0, 'f', 1) + " ms";
+        if (timing.bytes > 0) {
+            stage.append(" (" + QString::number(timing.bytes/1024.0/1024.0, 'f', 1) + " MB)");
+        }
+        stages << stage;
+        total += timing.usec;
+    }
+    QString message;
+    if (!stages.isEmpty()) {
+        message = result.job.left(1).toUpper() + result.job.mid(1) + ": " + stages.join(", ") + ", " + tr("total %1 ms").arg(QString::number(total/1000.0, 'f', 1));
+    }
+    if (result.memory > 0) {
+        if (!message.isEmpty()) {
+            message.append(" | ");
+        }
+        message.append(tr("Working image uses %1 MB").arg(QString::number(result.memory/1024.0/1024.0, 'f', 1)));
+    }
+
+    // transform cache use since the last report, a profile flip should only hit
+    blackCacheStats cache = Black::cacheStats();
+    cache.hits -= cacheReported.hits;
+    cache.misses -= cacheReported.misses;
+    cache.evictions -= cacheReported.evictions;
+    cacheReported = Black::cacheStats();
+    if (!message.isEmpty()) {
+        message.append(" | " + tr("Transforms: %1 hits, %2 misses, %3 evicted, %4 MB cached")
+                       .arg(cache.hits)
+                       .arg(cache.misses)
+                       .arg(cache.evictions)
+                       .arg(QString::number(cache.cost/1024.0/1024.0, 'f', 1)));
+        statusBar()->showMessage(message);
+    }
+    if (logTimingsAction->isChecked()) {
+        logTimings(result, cache);
+    }
+}
+
+void Cyan::logTimings(magentaImage result, blackCacheStats cache)
+{
+    // one JSON object per request
+    QString line = "{\"time\":" + Magenta::jsonString(QDateTime::currentDateTime().toString(Qt::ISODate));
+    line.append(",\"job\":" + Magenta::jsonString(result.job));
+    line.append(",\"file\":" + Magenta::jsonString(result.filename.isEmpty()?currentImageFile:result.filename));
+    line.append(",\"width\":" + QString::number(result.width));
+    line.append(",\"height\":" + QString::number(result.height));
+    line.append(",\"memory\":" + QString::number(result.memory));
+    if (!result.error.isEmpty()) {
+        line.append(",\"error\":" + Magenta::jsonString(result.error.trimmed()));
+    }
+    line.append(",\"stages\":[");
+    for (int i = 0; i < result.timings.size(); ++i) {
+        magentaTiming timing = result.timings.at(i);
+        if (i > 0) {
+            line.append(",");
+        }
+        line.append("{\"stage\":" + Magenta::jsonString(timing.stage) + ",\"usec\":" + QString::number(timing.usec) + ",\"bytes\":" + QString::number(timing.bytes) + "}");
+    }
+    line.append("]");
+    line.append(",\"cache\":{\"hits\":" + QString::number(cache.hits) + ",\"misses\":" + QString::number(cache.misses) + ",\"evictions\":" + QString::number(cache.evictions) + ",\"bytes\":" + QString::number(cache.cost) + ",\"transforms\":" + QString::number(cache.count) + "}");
+    line.append("}\n");
+    writeTimingsLog(line);
+}
+
+void Cyan::showProfileTimings()
+{
+    // the profile scan at startup, "Profiles: 412 found, 3 parsed, 18 ms"
+    yellowRegistryStats stats = Yellow::registryStats();
+    statusBar()->showMessage(tr("Profiles: %1 found, %2 parsed, %3 ms").arg(stats.total).arg(stats.parsed).arg(stats.msec));
+    if (logTimingsAction->isChecked()) {
+        QString line = "{\"time\":" + Magenta::jsonString(QDateTime::currentDateTime().toString(Qt::ISODate));
+        line.append(",\"job\":\"profiles\"");
+        line.append(",\"profiles\":" + QString::number(stats.total));
+        line.append(",\"parsed\":" + QString::number(stats.parsed));
+        line.append(",\"msec\":" + QString::number(stats.msec) + "}\n");
+        writeTimingsLog(line);
+    }
+}
+
+void Cyan::writeTimingsLog(QString line)
+{
+    QString file = timingsLogFile();
+    QDir().mkpath(QFileInfo(file).absolutePath());
+    QFile log(file);
+    if (log.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        log.write(line.toUtf8());
+        log.close();
+    }
+}
+
+void Cyan::addTileTimings(int count, qint64 usec, qint64 bytes)
+{
+    tileCount += count;
+    tileUsec += usec;
+    tileBytes += bytes;
+    tileTimer.start();
+}
+
+void Cyan::showTileTimings()
+{
+    // tiles arrive in batches after the request that made them has been reported,
+    // they are summed up once the viewer has been idle for CYAN_TILE_REPORT ms
+    if (tileCount == 0) {
+        return;
+    }
+    magentaImage result;
+    result.job = "tiles";
+    result.preview = false;
+    result.saved = false;
+    result.colorspace = 0;
+    result.width = 0;
+    result.height = 0;
+    result.memory = 0;
+    result.generation = 0;
+    result.scale = 1;
+    magentaTiming timing;
+    timing.stage = "display";
+    timing.usec = tileUsec;
+    timing.bytes = tileBytes;
+    result.timings << timing;
+    tileCount = 0;
+    tileUsec = 0;
+    tileBytes = 0;
+    showTimings(result);
+}
+
+QString Cyan::timingsLogFile()
+{
+    QSettings settings;
+    settings.beginGroup("performance");
+    QString file = settings.value("logFile").toString();
+    settings.endGroup();
+    if (file.isEmpty()) {
+        file = QFileInfo(Yellow::catalogFile()).absolutePath() + "/timings.log";
+    }
+    return file;
+}
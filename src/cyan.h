@@ -33,9 +33,128 @@
 #include <QMenuBar>
 #include <QAction>
 #include <QByteArray>
+#include <QGraphicsItem>
+#include <QGraphicsObject>
+#include <QCache>
+#include <QFutureWatcher>
+#include <QSpinBox>
+#include <QLabel>
+#include <QTimer>
 
 #include "yellow.h"
 #include "magenta.h"
+#include "black.h"
+
+#define CYAN_TILE_SIZE 256
+#define CYAN_TILE_CACHE 131072 // KB
+#define CYAN_TILE_LEVELS 8
+#define CYAN_TILE_BATCH 8
+#define CYAN_ALTERNATE_CACHE 65536 // KB
+#define CYAN_GAMUT_CACHE 32768 // KB
+#define CYAN_COVERAGE_CACHE 32768 // KB
+#define CYAN_TILE_REPORT 500 // msec
+
+#define CYAN_TILE_DISPLAY 0
+#define CYAN_TILE_GAMUT 1
+#define CYAN_TILE_COVERAGE 2
+
+// one tile (or the mask over it) converted away from the GUI thread
+struct CyanTileJob {
+    int kind;
+    qint64 key;
+    blackImage level;
+    QRect rect;
+    blackTransform transform;
+    blackCancel cancel;
+    int limit; // ink limit of a coverage tile
+    QImage tile;
+    qint64 usec; // conversion time
+    CyanTileJob() : kind(CYAN_TILE_DISPLAY), key(0), limit(0), usec(0) {}
+};
+
+// ink coverage of an image through a CMYK output transform, image and transform
+// tell if a result still holds
+struct CyanCoverage {
+    blackImage image;
+    blackTransform transform;
+    blackCoverage stats;
+};
+
+// Tiles are converted away from the GUI thread, CYAN_TILE_BATCH at a time. Until a
+// tile arrives the cached tile of a coarser level (or the quick preview) stands in
+// for it, missing pyramid levels are made in the background too.
+//
+// The viewer keeps a second transform (the other side of the proof toggle) with its
+// own tile cache, the visible tiles are converted for it in the background so the
+// toggle is a swap. Tiles past CYAN_ALTERNATE_CACHE are converted on demand after it.
+//
+// With a gamut transform (see Black::gamutTransform) an out of gamut mask is drawn
+// over each visible tile, masks are made in the background after the tile and kept
+// until the pixels or the gamut transform change. The TAC heat map (see
+// Black::coverageImage) works the same way with the CMYK output transform and the
+// ink limit.
+
+class CyanTiles : public QGraphicsObject
+{
+    Q_OBJECT
+public:
+    explicit CyanTiles(QGraphicsItem *parent = 0);
+    ~CyanTiles();
+    QRectF boundingRect() const;
+    void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget);
+    // size is the full image, source may be a reduced decode of it
+    // cancel stops the tile conversions for this source once a newer preview is requested
+    void setSource(blackImage image, blackTransform display, QList<blackImage> pyramid = QList<blackImage>(), QSize full = QSize(), blackCancel cancel = blackCancel());
+    void setQuick(QImage image, int width, int height);
+    void setAlternate(blackTransform display);
+    void setGamut(blackTransform gamut);
+    void setCoverage(blackTransform coverage, int limit);
+    blackImage getSource() const { return source; }
+    bool swapAlternate();
+    // tiles of the visible area (scene coordinates) at scale not yet converted for the alternate
+    QList<CyanTileJob> alternateJobs(QRectF visible, qreal scale);
+    int addTiles(QList<CyanTileJob> jobs);
+    static QList<CyanTileJob> renderTiles(QList<CyanTileJob> jobs);
+    static QList<blackImage> buildLevels(QList<blackImage> levels, blackCancel cancel);
+    static blackTransform gamutTransform(blackImage image, QList<QByteArray> profiles, int intent, bool black);
+    static CyanCoverage inkCoverage(blackImage image, QList<QByteArray> profiles, magentaAdjust edit, CyanCoverage previous, blackCancel cancel);
+
+signals:
+    // tiles added to the caches, usec is their conversion time
+    void tilesConverted(int count, qint64 usec, qint64 bytes);
+
+private slots:
+    void tilesReady();
+    void levelsReady();
+
+private:
+    QImage quick;
+    QImage backdrop;
+    QSize size;
+    blackImage source;
+    blackCancel sourceCancel;
+    blackTransform transform;
+    blackTransform alternate;
+    blackTransform gamut;
+    blackTransform coverage;
+    int coverageLimit;
+    QList<blackImage> levels;
+    QCache<qint64, QImage> *tiles;
+    QCache<qint64, QImage> *alternateTiles;
+    QCache<qint64, QImage> gamutTiles;
+    QCache<qint64, QImage> coverageTiles;
+    QFutureWatcher<QList<CyanTileJob> > tileWatcher;
+    QFutureWatcher<QList<blackImage> > levelWatcher;
+    bool tilesWanted;
+    blackImage getLevel(int level);
+    int getLevelFor(qreal scale);
+    QRect getArea(int level, QRectF exposed);
+    QRect tileRect(int level, int column, int row);
+    void paintPlaceholder(QPainter *painter, int level, int column, int row, QRectF target);
+    void requestTiles(QList<CyanTileJob> jobs);
+    void requestLevels();
+    static qint64 tileKey(int level, int column, int row);
+};
 
 class CyanView : public QGraphicsView
 {
@@ -69,6 +188,7 @@ private:
     Magenta proc;
     QGraphicsScene *scene;
     CyanView *view;
+    CyanTiles *tiles;
     QToolBar *mainBar;
     QToolBar *convertBar;
     QToolBar *profileBar;
@@ -88,11 +208,31 @@ private:
     QAction *openImageAction;
     QAction *saveImageAction;
     QAction *quitAction;
-    QByteArray currentImageData;
+    QString currentImageFile;
+    QString probedImageFile;
+    int currentImageScale;
     QByteArray currentImageProfile;
     QByteArray currentImageNewProfile;
     QCheckBox *monitorCheckBox;
+    QCheckBox *gamutCheckBox;
+    int alternateGeneration;
+    QFutureWatcher<QList<CyanTileJob> > alternateWatcher;
+    QFutureWatcher<blackTransform> gamutWatcher;
+    blackImage gamutFormat;
+    QCheckBox *coverageCheckBox;
+    QSpinBox *coverageLimit;
+    QLabel *coverageLabel;
+    CyanCoverage currentCoverage;
+    QAtomicInt coverageTicket;
+    QFutureWatcher<CyanCoverage> coverageWatcher;
     QAction *exportEmbeddedProfileAction;
+    QAction *exportDeviceLinkAction;
+    QAction *logTimingsAction;
+    int tileCount;
+    qint64 tileUsec;
+    qint64 tileBytes;
+    QTimer tileTimer;
+    blackCacheStats cacheReported; // transform cache counters at the last report
 
 private slots:
     void readConfig();
@@ -110,9 +250,13 @@ private slots:
     void updateGrayDefaultProfile(int index);
     void updateMonitorDefaultProfile(int index);
     void getImage(magentaImage result);
+    void setImageTitle(QString file, int colorspace, int width, int height);
     void imageClear();
     void resetImageZoom();
-    void setImage(QByteArray image);
+    double fitImageZoom(int width, int height);
+    void imageZoomChanged();
+    void setImage(blackImage source, blackTransform transform, QList<blackImage> levels, int width, int height, blackCancel cancel);
+    void setQuickImage(QImage image, int width, int height);
     void updateImage();
     QByteArray getMonitorProfile();
     QByteArray getOutputProfile();
@@ -120,11 +264,30 @@ private slots:
     void inputProfileChanged(int index);
     void outputProfileChanged(int index);
     void monitorCheckBoxChanged(bool triggered);
+    void gamutCheckBoxChanged(bool triggered);
+    void alternateTilesReady();
+    void updateGamut();
+    void gamutReady();
+    void updateCoverage();
+    void coverageReady();
+    void coverageLimitChanged(int limit);
+    void showCoverage();
     void enableUI();
     void disableUI();
     void triggerMonitor();
     void exportEmbeddedProfileDialog();
     void exportEmbeddedProfile(QString file);
+    void exportDeviceLinkDialog();
+    void exportDeviceLink(QString file);
+    QByteArray getInputProfile();
+    QString getDeviceLinkDescription();
+    void showTimings(magentaImage result);
+    void addTileTimings(int count, qint64 usec, qint64 bytes);
+    void showTileTimings();
+    void logTimings(magentaImage result, blackCacheStats cache);
+    void showProfileTimings();
+    void writeTimingsLog(QString line);
+    QString timingsLogFile();
 };
 
 #endif // CYAN_H
@@ -0,0 +1,393 @@
+/*
+* Cyan <https://github.com/olear/cyan>,
+* Copyright (C) 2016 Ole-André Rodlie
+*
+* Cyan is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License version 2 as published
+* by the Free Software Foundation.
+*
+* Cyan is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Cyan.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+*/
+
+#include "cyanbatch.h"
+#include <QCoreApplication>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QSettings>
+#include <QTextStream>
+#include <QElapsedTimer>
+#include <QThreadPool>
+#include <QtConcurrentMap>
+#include <cstring>
+
+CyanBatch::CyanBatch(QObject *parent) :
+    QObject(parent)
+{
+}
+
+CyanBatch::~CyanBatch()
+{
+}
+
+int CyanBatch::run(QStringList args)
+{
+    // no Magenta object is created in batch mode, only its static helpers are used
+    Magick::InitializeMagick(NULL);
+    if (args.contains("--inspect")) {
+        return inspect(args);
+    }
+
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+
+    cyanBatchOptions options;
+    QString error;
+    if (!parseArguments(args, &options, &error)) {
+        err << error << "\n\n" << usage();
+        err.flush();
+        return CYAN_EXIT_USAGE;
+    }
+
+    // same engine settings as the GUI, --threads overrides
+    QSettings settings;
+    settings.beginGroup("cache");
+    Black::setCacheLimit(settings.value("transforms", 64).toLongLong()*1024*1024);
+    settings.endGroup();
+    settings.beginGroup("performance");
+    Black::setThreads(options.threads>0?options.threads:settings.value("threads", 0).toInt());
+    settings.endGroup();
+
+    // results arrive in completion order
+    QElapsedTimer timer;
+    timer.start();
+    CyanPipeline pipeline;
+    pipeline.start(options);
+    int failed = 0;
+    cyanBatchResult result;
+    while (pipeline.nextResult(&result)) {
+        if (!result.ok) {
+            failed++;
+        }
+        out << jsonResult(result) << "\n";
+        out.flush();
+    }
+    pipeline.wait();
+    out << jsonStats(pipeline.stats(), options.files.size(), failed, timer.elapsed()) << "\n";
+    out.flush();
+    return failed>0?CYAN_EXIT_FAILED:CYAN_EXIT_OK;
+}
+
+int CyanBatch::inspect(QStringList args)
+{
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+
+    QStringList files;
+    int threads = 0;
+    for (int i = 1; i < args.size(); ++i) {
+        QString arg = args.at(i);
+        if (arg == "--inspect") {
+            continue;
+        } else if (arg == "--threads") {
+            if (i+1 >= args.size()) {
+                err << tr("Missing value for %1").arg(arg) << "\n\n" << usage();
+                err.flush();
+                return CYAN_EXIT_USAGE;
+            }
+            threads = args.at(++i).toInt();
+        } else if (arg.startsWith("--")) {
+            err << tr("Unknown option %1").arg(arg) << "\n\n" << usage();
+            err.flush();
+            return CYAN_EXIT_USAGE;
+        } else {
+            files << arg;
+        }
+    }
+    if (files.isEmpty()) {
+        err << tr("No input files") << "\n\n" << usage();
+        err.flush();
+        return CYAN_EXIT_USAGE;
+    }
+
+    // headers only, so this is mostly waiting on the disk, results are printed in argument order
+    QElapsedTimer timer;
+    timer.start();
+    if (threads > 0) {
+        QThreadPool::globalInstance()->setMaxThreadCount(threads);
+    }
+    QFuture<magentaInfo> probes = QtConcurrent::mapped(files, magentaProbe::probe);
+    Yellow yellow;
+    int failed = 0;
+    for (int i = 0; i < files.size(); ++i) {
+        magentaInfo info = probes.resultAt(i);
+        if (!info.isValid()) {
+            failed++;
+        }
+        out << jsonInfo(info, info.profile.isEmpty()?QString():yellow.profileDescFromData(info.profile)) << "\n";
+        out.flush();
+    }
+    out << "{\"summary\":{\"files\":" << files.size() << ",\"failed\":" << failed << ",\"msec\":" << timer.elapsed() << "}}\n";
+    out.flush();
+    return failed>0?CYAN_EXIT_FAILED:CYAN_EXIT_OK;
+}
+
+bool CyanBatch::parseArguments(QStringList args, cyanBatchOptions *options, QString *error)
+{
+    options->threads = 0;
+    options->overwrite = false;
+    options->queue = CYAN_STAGE_QUEUE;
+    options->workers[CYAN_STAGE_READ] = 1;
+    options->workers[CYAN_STAGE_DECODE] = 2;
+    options->workers[CYAN_STAGE_TRANSFORM] = 1; // Black already splits each image over its thread pool
+    options->workers[CYAN_STAGE_ENCODE] = 2;
+    options->edit.brightness = 100;
+    options->edit.saturation = 100;
+    options->edit.hue = 100;
+    options->edit.intent = 0;
+    options->edit.black = false;
+    bool renderingOptions = false;
+
+    for (int i = 1; i < args.size(); ++i) {
+        QString arg = args.at(i);
+        bool hasValue = i+1 < args.size();
+        if (arg == "--convert") {
+            continue;
+        } else if (arg == "--bpc") {
+            options->edit.black = true;
+            renderingOptions = true;
+        } else if (arg == "--overwrite") {
+            options->overwrite = true;
+        } else if (arg == "--in-profile" || arg == "--out-profile" || arg == "--device-link" || arg == "--intent" || arg == "--threads" || arg == "--workers" || arg == "--queue" || arg == "-o") {
+            if (!hasValue) {
+                error->append(tr("Missing value for %1").arg(arg));
+                return false;
+            }
+            QString value = args.at(++i);
+            if (arg == "--in-profile") {
+                options->inputProfileFile = value;
+            } else if (arg == "--out-profile") {
+                options->outputProfileFile = value;
+            } else if (arg == "--device-link") {
+                options->deviceLinkFile = value;
+            } else if (arg == "-o") {
+                options->outputDir = value;
+            } else if (arg == "--threads") {
+                options->threads = value.toInt();
+            } else if (arg == "--queue") {
+                options->queue = qMax(1, value.toInt());
+            } else if (arg == "--workers") {
+                QStringList counts = value.split(",");
+                if (counts.size() != CYAN_STAGES) {
+                    error->append(tr("--workers needs %1 comma separated counts").arg(CYAN_STAGES));
+                    return false;
+                }
+                for (int stage = 0; stage < CYAN_STAGES; ++stage) {
+                    options->workers[stage] = qMax(1, counts.at(stage).toInt());
+                }
+            } else {
+                renderingOptions = true;
+                QString intent = value.toLower();
+                if (intent == "undefined" || intent == "0") {
+                    options->edit.intent = 0;
+                } else if (intent == "saturation" || intent == "1") {
+                    options->edit.intent = 1;
+                } else if (intent == "perceptual" || intent == "2") {
+                    options->edit.intent = 2;
+                } else if (intent == "absolute" || intent == "3") {
+                    options->edit.intent = 3;
+                } else {
+                    error->append(tr("Unknown rendering intent %1").arg(value));
+                    return false;
+                }
+            }
+        } else if (arg.startsWith("--")) {
+            error->append(tr("Unknown option %1").arg(arg));
+            return false;
+        } else {
+            options->files << arg;
+        }
+    }
+
+    if (options->files.isEmpty()) {
+        error->append(tr("No input files"));
+        return false;
+    }
+    if (options->outputProfileFile.isEmpty() && options->deviceLinkFile.isEmpty()) {
+        error->append(tr("--out-profile or --device-link is required"));
+        return false;
+    }
+    if (!options->deviceLinkFile.isEmpty() && !options->inputProfileFile.isEmpty()) {
+        error->append(tr("--in-profile can not be used with --device-link"));
+        return false;
+    }
+    if (!options->deviceLinkFile.isEmpty() && renderingOptions) {
+        error->append(tr("--intent and --bpc can not be used with --device-link, the link holds them"));
+        return false;
+    }
+    if (options->outputDir.isEmpty()) {
+        error->append(tr("-o is required"));
+        return false;
+    }
+
+    QFileInfo outputDir(options->outputDir);
+    if (!outputDir.exists()) {
+        QDir().mkpath(options->outputDir);
+    }
+    if (!QFileInfo(options->outputDir).isDir()) {
+        error->append(tr("Unable to use output folder %1").arg(options->outputDir));
+        return false;
+    }
+
+    QStringList profileFiles;
+    profileFiles << options->inputProfileFile << options->outputProfileFile << options->deviceLinkFile;
+    for (int i = 0; i < profileFiles.size(); ++i) {
+        if (profileFiles.at(i).isEmpty()) {
+            continue;
+        }
+        QByteArray bytes;
+        QFile profile(profileFiles.at(i));
+        if (profile.open(QIODevice::ReadOnly)) {
+            bytes = profile.readAll();
+            profile.close();
+        }
+        Black black;
+        if (black.profileColorSpace(bytes) == 0) {
+            error->append(tr("Unable to use profile %1").arg(profileFiles.at(i)));
+            return false;
+        }
+        if (black.isDeviceLink(bytes) != (i == 2)) {
+            error->append(i == 2?tr("%1 is not a device link").arg(profileFiles.at(i)):tr("%1 is a device link, use --device-link").arg(profileFiles.at(i)));
+            return false;
+        }
+        if (i == 0) {
+            options->inputProfile = bytes;
+        } else if (i == 1) {
+            options->outputProfile = bytes;
+        } else {
+            options->deviceLink = bytes;
+        }
+    }
+    if (!options->deviceLink.isEmpty() && !options->outputProfile.isEmpty()) {
+        Black black;
+        if (black.outputColorSpace(options->deviceLink) != black.profileColorSpace(options->outputProfile)) {
+            error->append(tr("%1 does not match the output of the device link").arg(options->outputProfileFile));
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CyanBatch::isBatch(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--convert") == 0 || std::strcmp(argv[i], "--inspect") == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+QString CyanBatch::usage()
+{
+    QString text;
+    text.append("Usage: cyan --convert --out-profile <icc> -o <folder> [options] <files>\n");
+    text.append("       cyan --convert --device-link <icc> -o <folder> [options] <files>\n");
+    text.append("       cyan --inspect [--threads <n>] <files>\n\n");
+    text.append("  --in-profile <icc>   input profile, default is the embedded or default profile\n");
+    text.append("  --out-profile <icc>  output profile, only embedded when used with --device-link\n");
+    text.append("  --device-link <icc>  convert with a device link, intent and BPC are part of the link\n");
+    text.append("  --intent <intent>    undefined, saturation, perceptual or absolute\n");
+    text.append("  --bpc                black point compensation\n");
+    text.append("  --threads <n>        conversion threads, 0 uses all cores\n");
+    text.append("  --workers <r,d,t,e>  workers for the read, decode, transform and encode stages, default 1,2,1,2\n");
+    text.append("  --queue <n>          images waiting between two stages, default 2\n");
+    text.append("  --overwrite          replace existing output files\n");
+    text.append("  -o <folder>          output folder, files are saved as TIFF\n\n");
+    text.append("One JSON object is written to stdout for each file, then a summary with\n");
+    text.append("the busy time and utilization of each stage.\n");
+    text.append("--inspect reads size, depth, colorspace and embedded profile from the file\n");
+    text.append("headers without decoding the pixels.\n");
+    text.append("Exit status is 0 when all files converted, 1 if any failed and 2 on usage errors.\n");
+    return text;
+}
+
+QString CyanBatch::jsonResult(cyanBatchResult result)
+{
+    QString output = "{";
+    output.append("\"file\":" + Magenta::jsonString(result.file));
+    output.append(",\"output\":" + Magenta::jsonString(result.output));
+    output.append(",\"status\":" + Magenta::jsonString(result.ok?"ok":"error"));
+    if (!result.error.isEmpty()) {
+        output.append(",\"error\":" + Magenta::jsonString(result.error.trimmed()));
+    }
+    if (!result.warning.isEmpty()) {
+        output.append(",\"warning\":" + Magenta::jsonString(result.warning.trimmed()));
+    }
+    output.append(",\"msec\":" + QString::number(result.msec));
+    output.append("}");
+    return output;
+}
+
+QString CyanBatch::jsonInfo(magentaInfo info, QString profile)
+{
+    QString colorspace;
+    switch (info.colorspace) {
+    case 1:
+        colorspace = "RGB";
+        break;
+    case 2:
+        colorspace = "CMYK";
+        break;
+    case 3:
+        colorspace = "GRAY";
+        break;
+    }
+    QString output = "{";
+    output.append("\"file\":" + Magenta::jsonString(info.file));
+    output.append(",\"status\":" + Magenta::jsonString(info.isValid()?"ok":"error"));
+    if (!info.error.isEmpty()) {
+        output.append(",\"error\":" + Magenta::jsonString(info.error.trimmed()));
+    }
+    output.append(",\"format\":" + Magenta::jsonString(info.format));
+    output.append(",\"width\":" + QString::number(info.width));
+    output.append(",\"height\":" + QString::number(info.height));
+    output.append(",\"depth\":" + QString::number(info.depth));
+    output.append(",\"colorspace\":" + Magenta::jsonString(colorspace));
+    output.append(",\"profile\":" + Magenta::jsonString(profile));
+    output.append(",\"profile_bytes\":" + QString::number(info.profile.size()));
+    output.append("}");
+    return output;
+}
+
+QString CyanBatch::jsonStats(QList<cyanStageStats> stats, int files, int failed, qint64 msec)
+{
+    QString output = "{\"summary\":{";
+    output.append("\"files\":" + QString::number(files));
+    output.append(",\"failed\":" + QString::number(failed));
+    output.append(",\"msec\":" + QString::number(msec));
+    output.append("},\"stages\":[");
+    for (int i = 0; i < stats.size(); ++i) {
+        cyanStageStats stage = stats.at(i);
+        if (i > 0) {
+            output.append(",");
+        }
+        output.append("{\"stage\":" + Magenta::jsonString(stage.name));
+        output.append(",\"workers\":" + QString::number(stage.workers));
+        output.append(",\"items\":" + QString::number(stage.items));
+        output.append(",\"busy_msec\":" + QString::number(stage.busy/1000));
+        output.append(",\"utilization\":" + QString::number(stage.utilization, 'f', 3));
+        if (stage.peakQueue >= 0) {
+            output.append(",\"peak_queue\":" + QString::number(stage.peakQueue));
+        }
+        output.append("}");
+    }
+    output.append("]}");
+    return output;
+}
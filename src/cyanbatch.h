@@ -0,0 +1,57 @@
+/*
+* Cyan <https://github.com/olear/cyan>,
+* Copyright (C) 2016 Ole-André Rodlie
+*
+* Cyan is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License version 2 as published
+* by the Free Software Foundation.
+*
+* Cyan is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Cyan.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+*/
+
+#ifndef CYANBATCH_H
+#define CYANBATCH_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+
+#include "cyanpipeline.h"
+#include "magentaprobe.h"
+
+// exit codes for the headless modes
+#define CYAN_EXIT_OK 0
+#define CYAN_EXIT_FAILED 1
+#define CYAN_EXIT_USAGE 2
+
+// headless conversion, "cyan --convert ...", one JSON object per file on stdout
+// followed by a summary with the pipeline stage statistics
+// "cyan --inspect ..." prints the header information of each file the same way
+class CyanBatch : public QObject
+{
+    Q_OBJECT
+public:
+    explicit CyanBatch(QObject *parent = 0);
+    ~CyanBatch();
+
+public slots:
+    int run(QStringList args);
+    int inspect(QStringList args);
+    bool parseArguments(QStringList args, cyanBatchOptions *options, QString *error);
+
+public:
+    static bool isBatch(int argc, char *argv[]);
+    static QString usage();
+    static QString jsonResult(cyanBatchResult result);
+    static QString jsonInfo(magentaInfo info, QString profile);
+    static QString jsonStats(QList<cyanStageStats> stats, int files, int failed, qint64 msec);
+};
+
+#endif // CYANBATCH_H
@@ -0,0 +1,822 @@
+/*
+* Cyan <https://github.com/olear/cyan>,
+* Copyright (C) 2016 Ole-André Rodlie
+*
+* Cyan is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License version 2 as published
+* by the Free Software Foundation.
+*
+* Cyan is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Cyan.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+*/
+
+// cyan-bench, times the conversion engine on generated images and profiles
+// and writes the results as JSON, see "cyan-bench --help"
+
+#include <QCoreApplication>
+#include <QStringList>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QTextStream>
+#include <QElapsedTimer>
+#include <QVector>
+#include <QThread>
+#include <lcms2.h>
+#include <Magick++.h>
+#include <algorithm>
+#if defined(Q_OS_UNIX)
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#include "magenta.h"
+#include "yellow.h"
+#include "black.h"
+#include "cyanbatch.h"
+#include "cyanpipeline.h"
+
+#define BENCH_PROFILE_COPIES 32
+
+struct benchOptions {
+    QList<int> sizes;
+    QList<int> threads;
+    int iterations;
+    bool lookupTables;
+    bool keep;
+    QString output;
+    QString folder;
+};
+
+struct benchPhase {
+    QString name;
+    QList<qint64> runs; // usec
+    qint64 pixels;
+    qint64 bytes;
+    qint64 rss; // KB, peak while the phase ran, 0 where unknown
+    // transform cache use over all runs, for phases that ask Black for a transform
+    bool cache;
+    qint64 hits;
+    qint64 misses;
+    qint64 evictions;
+    qint64 cacheBytes;
+    benchPhase() : pixels(0), bytes(0), rss(0), cache(false), hits(0), misses(0), evictions(0), cacheBytes(0) {}
+};
+
+struct benchCase {
+    QString format;
+    QString file;
+    int colorspace;
+    int depth;
+    int width;
+    int height;
+    qint64 fileBytes;
+    QString error;
+    QList<benchPhase> phases;
+};
+
+// peak RSS seen by any phase, the phases reset the kernel counter
+static qint64 benchPeakSeen = 0;
+
+static bool benchResetPeak()
+{
+    // resets VmHWM to the current RSS, Linux only
+#if defined(Q_OS_LINUX)
+    QFile refs("/proc/self/clear_refs");
+    if (refs.open(QIODevice::WriteOnly)) {
+        bool reset = refs.write("5") == 1;
+        refs.close();
+        return reset;
+    }
+#endif
+    return false;
+}
+
+static qint64 benchPeakRss()
+{
+    // KB since the last benchResetPeak, 0 where unknown
+    qint64 peak = 0;
+#if defined(Q_OS_LINUX)
+    QFile status("/proc/self/status");
+    if (status.open(QIODevice::ReadOnly)) {
+        QByteArray line;
+        while (!(line = status.readLine()).isEmpty()) {
+            if (line.startsWith("VmHWM:")) {
+                peak = line.mid(6).trimmed().split(' ').first().toLongLong();
+                break;
+            }
+        }
+        status.close();
+    }
+#endif
+    benchPeakSeen = qMax(benchPeakSeen, peak);
+    return peak;
+}
+
+static qint64 benchProcessPeak()
+{
+    // KB over the whole run, 0 where the platform has no getrusage
+    qint64 peak = benchPeakSeen;
+#if defined(Q_OS_UNIX)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#if defined(Q_OS_MAC)
+        peak = qMax(peak, (qint64)usage.ru_maxrss/1024);
+#else
+        peak = qMax(peak, (qint64)usage.ru_maxrss);
+#endif
+    }
+#endif
+    return peak;
+}
+
+// one timed run, the phase keeps the highest peak of its runs when the peak could be reset
+static void benchRecord(benchPhase *phase, qint64 usec, bool reset)
+{
+    phase->runs << usec;
+    if (reset) {
+        phase->rss = qMax(phase->rss, benchPeakRss());
+    }
+}
+
+static QString benchColorspace(int colorspace)
+{
+    switch (colorspace) {
+    case 2:
+        return "CMYK";
+    case 3:
+        return "GRAY";
+    }
+    return "RGB";
+}
+
+static QByteArray benchSaveProfile(cmsHPROFILE profile)
+{
+    QByteArray bytes;
+    cmsUInt32Number length = 0;
+    if (profile && cmsSaveProfileToMem(profile, NULL, &length) && length > 0) {
+        bytes.resize((int)length);
+        if (!cmsSaveProfileToMem(profile, bytes.data(), &length)) {
+            bytes.clear();
+        }
+    }
+    if (profile) {
+        cmsCloseProfile(profile);
+    }
+    return bytes;
+}
+
+static void benchDescription(cmsHPROFILE profile, const char *description)
+{
+    cmsMLU *text = cmsMLUalloc(NULL, 1);
+    cmsMLUsetASCII(text, "en", "US", description);
+    cmsWriteTag(profile, cmsSigProfileDescriptionTag, text);
+    cmsMLUfree(text);
+}
+
+// naive CMYK, c = 1-r with gray component replaced by k, measured through sRGB
+static cmsInt32Number benchCmykToLab(const cmsUInt16Number input[], cmsUInt16Number output[], void *cargo)
+{
+    double k = input[3]/65535.0;
+    double rgb[3];
+    for (int i = 0; i < 3; ++i) {
+        rgb[i] = (1.0-input[i]/65535.0)*(1.0-k);
+    }
+    cmsCIELab lab;
+    cmsDoTransform((cmsHTRANSFORM)cargo, rgb, &lab, 1);
+    cmsFloat2LabEncoded(output, &lab);
+    return TRUE;
+}
+
+static cmsInt32Number benchLabToCmyk(const cmsUInt16Number input[], cmsUInt16Number output[], void *cargo)
+{
+    cmsCIELab lab;
+    cmsLabEncoded2Float(&lab, input);
+    double rgb[3];
+    cmsDoTransform((cmsHTRANSFORM)cargo, &lab, rgb, 1);
+    double k = 1.0-qMax(qMax(rgb[0], rgb[1]), rgb[2]);
+    k = qBound(0.0, k, 1.0);
+    for (int i = 0; i < 3; ++i) {
+        double c = k<1.0?(1.0-rgb[i]-k)/(1.0-k):0.0;
+        output[i] = (cmsUInt16Number)(qBound(0.0, c, 1.0)*65535.0+0.5);
+    }
+    output[3] = (cmsUInt16Number)(k*65535.0+0.5);
+    return TRUE;
+}
+
+static QByteArray benchCmykProfile()
+{
+    cmsHPROFILE srgb = cmsCreate_sRGBProfile();
+    cmsHPROFILE lab = cmsCreateLab4Profile(NULL);
+    cmsHTRANSFORM toLab = cmsCreateTransform(srgb, TYPE_RGB_DBL, lab, TYPE_Lab_DBL, INTENT_RELATIVE_COLORIMETRIC, cmsFLAGS_NOCACHE);
+    cmsHTRANSFORM fromLab = cmsCreateTransform(lab, TYPE_Lab_DBL, srgb, TYPE_RGB_DBL, INTENT_RELATIVE_COLORIMETRIC, cmsFLAGS_NOCACHE);
+    cmsCloseProfile(srgb);
+    cmsCloseProfile(lab);
+    if (!toLab || !fromLab) {
+        return QByteArray();
+    }
+
+    cmsHPROFILE profile = cmsCreateProfilePlaceholder(NULL);
+    cmsSetProfileVersion(profile, 4.3);
+    cmsSetDeviceClass(profile, cmsSigOutputClass);
+    cmsSetColorSpace(profile, cmsSigCmykData);
+    cmsSetPCS(profile, cmsSigLabData);
+    cmsWriteTag(profile, cmsSigMediaWhitePointTag, cmsD50_XYZ());
+    benchDescription(profile, "Cyan bench CMYK");
+
+    cmsPipeline *aToB = cmsPipelineAlloc(NULL, 4, 3);
+    cmsStage *aToBClut = cmsStageAllocCLut16bit(NULL, 9, 4, 3, NULL);
+    cmsStageSampleCLut16bit(aToBClut, benchCmykToLab, toLab, 0);
+    cmsPipelineInsertStage(aToB, cmsAT_END, aToBClut);
+    cmsWriteTag(profile, cmsSigAToB0Tag, aToB);
+    cmsPipelineFree(aToB);
+
+    cmsPipeline *bToA = cmsPipelineAlloc(NULL, 3, 4);
+    cmsStage *bToAClut = cmsStageAllocCLut16bit(NULL, 17, 3, 4, NULL);
+    cmsStageSampleCLut16bit(bToAClut, benchLabToCmyk, fromLab, 0);
+    cmsPipelineInsertStage(bToA, cmsAT_END, bToAClut);
+    cmsWriteTag(profile, cmsSigBToA0Tag, bToA);
+    cmsPipelineFree(bToA);
+
+    cmsDeleteTransform(toLab);
+    cmsDeleteTransform(fromLab);
+    return benchSaveProfile(profile);
+}
+
+static QByteArray benchRgbProfile()
+{
+    cmsHPROFILE profile = cmsCreate_sRGBProfile();
+    benchDescription(profile, "Cyan bench sRGB");
+    return benchSaveProfile(profile);
+}
+
+static QByteArray benchGrayProfile()
+{
+    cmsToneCurve *curve = cmsBuildGamma(NULL, 2.2);
+    cmsHPROFILE profile = cmsCreateGrayProfile(cmsD50_xyY(), curve);
+    cmsFreeToneCurve(curve);
+    benchDescription(profile, "Cyan bench Gray 2.2");
+    return benchSaveProfile(profile);
+}
+
+static QByteArray benchProfile(int colorspace)
+{
+    static QByteArray profiles[4];
+    if (profiles[colorspace].isEmpty()) {
+        switch (colorspace) {
+        case 1:
+            profiles[colorspace] = benchRgbProfile();
+            break;
+        case 2:
+            profiles[colorspace] = benchCmykProfile();
+            break;
+        case 3:
+            profiles[colorspace] = benchGrayProfile();
+            break;
+        }
+    }
+    return profiles[colorspace];
+}
+
+static bool benchWriteFile(QString file, QByteArray data)
+{
+    QFile output(file);
+    if (!output.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    bool written = output.write(data) == data.size();
+    output.close();
+    return written;
+}
+
+// gradients with a fine pattern on top, so neither the encoders nor the caches see flat areas
+static QString benchImage(benchCase *image, QString folder)
+{
+    int channels = image->colorspace==2?4:(image->colorspace==3?1:3);
+    QVector<float> pixels(image->width*image->height*channels);
+    for (int y = 0; y < image->height; ++y) {
+        for (int x = 0; x < image->width; ++x) {
+            float *pixel = pixels.data()+(y*image->width+x)*channels;
+            for (int c = 0; c < channels; ++c) {
+                float gradient = c%2?(float)x/image->width:(float)y/image->height;
+                float pattern = ((x*7+y*13+c*29)%32)/256.0f;
+                pixel[c] = qBound(0.0f, gradient*0.875f+pattern, 1.0f);
+            }
+        }
+    }
+
+    std::string map = image->colorspace==2?"CMYK":(image->colorspace==3?"I":"RGB");
+    Magick::Image output(image->width, image->height, map, Magick::FloatPixel, pixels.constData());
+    output.depth(image->depth);
+    if (image->depth == 32) {
+        output.defineValue("quantum", "format", "floating-point");
+    }
+    QByteArray profile = benchProfile(image->colorspace);
+    output.iccColorProfile(Magick::Blob(profile.constData(), profile.length()));
+    output.magick(image->format.toUpper().toStdString());
+    // the format is part of the base name, batch outputs are named after it
+    image->file = QString("%1/%2-%3-%4-%5-%6.%6").arg(folder).arg(benchColorspace(image->colorspace).toLower()).arg(image->depth).arg(image->width).arg(image->height).arg(image->format);
+    output.write(image->file.toUtf8().data());
+    image->fileBytes = QFileInfo(image->file).size();
+    return image->file;
+}
+
+static qint64 benchMedian(QList<qint64> runs)
+{
+    if (runs.isEmpty()) {
+        return 0;
+    }
+    std::sort(runs.begin(), runs.end());
+    return runs.at(runs.size()/2);
+}
+
+// adds the transform cache use since before to phase
+static void benchCache(benchPhase *phase, blackCacheStats before)
+{
+    blackCacheStats after = Black::cacheStats();
+    phase->cache = true;
+    phase->hits += after.hits-before.hits;
+    phase->misses += after.misses-before.misses;
+    phase->evictions += after.evictions-before.evictions;
+    phase->cacheBytes = after.cost;
+}
+
+static QString benchPhaseJson(benchPhase phase)
+{
+    qint64 median = benchMedian(phase.runs);
+    qint64 best = phase.runs.isEmpty()?0:*std::min_element(phase.runs.begin(), phase.runs.end());
+    QString output = "{\"phase\":" + Magenta::jsonString(phase.name);
+    output.append(",\"msec\":" + QString::number(median/1000.0, 'f', 3));
+    output.append(",\"min_msec\":" + QString::number(best/1000.0, 'f', 3));
+    output.append(",\"runs\":" + QString::number(phase.runs.size()));
+    if (phase.pixels > 0 && median > 0) {
+        output.append(",\"mpix_s\":" + QString::number(phase.pixels/(double)median, 'f', 2));
+    }
+    if (phase.bytes > 0 && median > 0) {
+        output.append(",\"mb_s\":" + QString::number(phase.bytes/(double)median, 'f', 2));
+    }
+    if (phase.rss > 0) {
+        output.append(",\"peak_rss_kb\":" + QString::number(phase.rss));
+    }
+    if (phase.cache) {
+        output.append(",\"cache_hits\":" + QString::number(phase.hits));
+        output.append(",\"cache_misses\":" + QString::number(phase.misses));
+        output.append(",\"cache_evictions\":" + QString::number(phase.evictions));
+        output.append(",\"cache_bytes\":" + QString::number(phase.cacheBytes));
+    }
+    output.append("}");
+    return output;
+}
+
+// phases mirror what the GUI asks Magenta for: open, preview (transform), render (viewer tiles),
+// convert (Black only) and save
+static void benchRun(benchCase *image, benchOptions options, Magenta *proc)
+{
+    Black black;
+    QByteArray inputProfile = benchProfile(image->colorspace);
+    QByteArray outputProfile = benchProfile(image->colorspace==2?1:2);
+    QByteArray monitorProfile = benchProfile(1);
+    QString saveFile = QFileInfo(image->file).absolutePath() + "/saved-" + QFileInfo(image->file).completeBaseName() + ".tif";
+    qint64 pixels = (qint64)image->width*image->height;
+    magentaAdjust edit;
+    edit.brightness = 100;
+    edit.saturation = 100;
+    edit.hue = 100;
+    edit.intent = 2;
+    edit.black = true;
+
+    benchPhase open, preview, transform, render, convert, save;
+    open.name = "open";
+    preview.name = "preview";
+    transform.name = "transform";
+    render.name = "render";
+    convert.name = "convert";
+    save.name = "save";
+    open.pixels = preview.pixels = render.pixels = convert.pixels = save.pixels = pixels;
+    transform.pixels = 0;
+    open.bytes = image->fileBytes;
+    preview.bytes = transform.bytes = render.bytes = convert.bytes = save.bytes = 0;
+    open.rss = preview.rss = transform.rss = render.rss = convert.rss = save.rss = 0;
+
+    for (int i = 0; i < options.iterations && image->error.isEmpty(); ++i) {
+        QElapsedTimer timer;
+        bool peak = benchResetPeak();
+        timer.start();
+        magentaImage opened = proc->readImage(false, false, image->file, magentaSource(), QByteArray(), QByteArray(), QByteArray(), edit);
+        benchRecord(&open, timer.nsecsElapsed()/1000, peak);
+        if (!opened.error.isEmpty()) {
+            image->error = opened.error;
+            break;
+        }
+
+        Black::clearCache();
+        peak = benchResetPeak();
+        timer.restart();
+        magentaImage previewed = proc->readImage(true, false, "", magentaSource(), inputProfile, outputProfile, monitorProfile, edit);
+        benchRecord(&preview, timer.nsecsElapsed()/1000, peak);
+        if (!previewed.error.isEmpty() || !previewed.transform) {
+            image->error = previewed.error.isEmpty()?QString("No preview transform"):previewed.error;
+            break;
+        }
+
+        Black::clearCache();
+        QList<QByteArray> profiles;
+        profiles << inputProfile << outputProfile;
+        int outputDepth = previewed.source.depth;
+        blackCacheStats cache = Black::cacheStats();
+        peak = benchResetPeak();
+        timer.restart();
+        blackTransform conversion = black.getTransform(profiles, black.pixelFormat(previewed.source.colorspace, previewed.source.depth), black.pixelFormat(black.profileColorSpace(outputProfile), outputDepth), edit.intent, edit.black);
+        benchRecord(&transform, timer.nsecsElapsed()/1000, peak);
+        benchCache(&transform, cache);
+
+        peak = benchResetPeak();
+        timer.restart();
+        QImage rendered = black.displayImage(previewed.source, previewed.transform, QRect(0, 0, image->width, image->height));
+        benchRecord(&render, timer.nsecsElapsed()/1000, peak);
+        render.bytes = rendered.byteCount();
+
+        // the transform phase made the transform, the conversion should only hit
+        QString error;
+        cache = Black::cacheStats();
+        peak = benchResetPeak();
+        timer.restart();
+        blackImage converted = black.convertImage(previewed.source, profiles, outputDepth, edit.intent, edit.black, &error);
+        benchRecord(&convert, timer.nsecsElapsed()/1000, peak);
+        benchCache(&convert, cache);
+        convert.bytes = converted.pixels.size();
+        if (converted.isNull()) {
+            image->error = error;
+            break;
+        }
+
+        peak = benchResetPeak();
+        timer.restart();
+        magentaImage saved = proc->readImage(false, true, saveFile, magentaSource(), inputProfile, outputProfile, QByteArray(), edit);
+        benchRecord(&save, timer.nsecsElapsed()/1000, peak);
+        if (!saved.saved) {
+            image->error = saved.error;
+            break;
+        }
+        save.bytes = QFileInfo(saveFile).size();
+    }
+    proc->releaseImage();
+
+    image->phases << open << preview << transform << render << convert << save;
+}
+
+// Black::convertImage and displayImage for one large image at each thread count,
+// the speedup is against the first thread count of the sweep
+static QString benchThreads(benchOptions options)
+{
+    benchCase image;
+    image.format = "tif";
+    image.colorspace = 2;
+    image.depth = 8;
+    image.width = options.sizes.last();
+    image.height = options.sizes.last();
+    benchImage(&image, options.folder);
+
+    Magenta proc;
+    magentaAdjust edit;
+    edit.brightness = 100;
+    edit.saturation = 100;
+    edit.hue = 100;
+    edit.intent = 2;
+    edit.black = false;
+    proc.readImage(false, false, image.file, magentaSource(), QByteArray(), QByteArray(), QByteArray(), edit);
+    magentaImage previewed = proc.readImage(true, false, "", magentaSource(), benchProfile(2), QByteArray(), benchProfile(1), edit);
+
+    Black black;
+    QList<QByteArray> profiles;
+    profiles << benchProfile(2) << benchProfile(1);
+    QString output = "[";
+    qint64 renderFirst = 0;
+    qint64 convertFirst = 0;
+    for (int i = 0; i < options.threads.size(); ++i) {
+        Black::setThreads(options.threads.at(i));
+        benchPhase render, convert;
+        render.name = "render";
+        convert.name = "convert";
+        render.pixels = convert.pixels = (qint64)image.width*image.height;
+        render.bytes = convert.bytes = 0;
+        render.rss = convert.rss = 0;
+        for (int j = 0; j < options.iterations; ++j) {
+            QElapsedTimer timer;
+            bool peak = benchResetPeak();
+            timer.start();
+            black.displayImage(previewed.source, previewed.transform, QRect(0, 0, image.width, image.height));
+            benchRecord(&render, timer.nsecsElapsed()/1000, peak);
+            QString error;
+            peak = benchResetPeak();
+            timer.restart();
+            black.convertImage(previewed.source, profiles, 8, edit.intent, edit.black, &error);
+            benchRecord(&convert, timer.nsecsElapsed()/1000, peak);
+        }
+        qint64 renderMedian = benchMedian(render.runs);
+        qint64 convertMedian = benchMedian(convert.runs);
+        if (i == 0) {
+            renderFirst = renderMedian;
+            convertFirst = convertMedian;
+        } else {
+            output.append(",");
+        }
+        output.append("{\"threads\":" + QString::number(Black::threads()));
+        if (renderMedian > 0 && convertMedian > 0) {
+            output.append(",\"render_speedup\":" + QString::number(renderFirst/(double)renderMedian, 'f', 2));
+            output.append(",\"convert_speedup\":" + QString::number(convertFirst/(double)convertMedian, 'f', 2));
+        }
+        output.append(",\"phases\":[" + benchPhaseJson(render) + "," + benchPhaseJson(convert) + "]}");
+    }
+    output.append("]");
+    Black::setThreads(options.threads.first());
+    QFile::remove(image.file);
+    return output;
+}
+
+// registry build from the system folders, and a cold and warm catalog scan of generated profiles
+static QString benchProfiles(benchOptions options)
+{
+    QString folder = options.folder + "/profiles";
+    QDir().mkpath(folder);
+    for (int i = 0; i < BENCH_PROFILE_COPIES; ++i) {
+        benchWriteFile(QString("%1/bench-%2.icc").arg(folder).arg(i), benchProfile(i%3+1));
+    }
+    QString catalog = options.folder + "/profiles.catalog";
+    QFile::remove(catalog);
+
+    Yellow yellow;
+    QStringList folders;
+    folders << folder;
+    benchPhase cold, warm, registry;
+    yellowRegistryStats coldStats = { 0, 0, 0 };
+    yellowRegistryStats warmStats = { 0, 0, 0 };
+    cold.name = "scan_cold";
+    warm.name = "scan_warm";
+    registry.name = "genProfiles";
+    cold.pixels = warm.pixels = registry.pixels = 0;
+    cold.bytes = warm.bytes = registry.bytes = 0;
+    cold.rss = warm.rss = registry.rss = 0;
+    for (int i = 0; i < options.iterations; ++i) {
+        QFile::remove(catalog);
+        QElapsedTimer timer;
+        bool peak = benchResetPeak();
+        timer.start();
+        yellow.scanProfiles(folders, catalog, &coldStats);
+        benchRecord(&cold, timer.nsecsElapsed()/1000, peak);
+        peak = benchResetPeak();
+        timer.restart();
+        yellow.scanProfiles(folders, catalog, &warmStats);
+        benchRecord(&warm, timer.nsecsElapsed()/1000, peak);
+        Yellow::clearRegistry();
+        peak = benchResetPeak();
+        timer.restart();
+        yellow.genProfiles(1);
+        benchRecord(&registry, timer.nsecsElapsed()/1000, peak);
+    }
+
+    QStringList files = QDir(folder).entryList(QDir::Files);
+    for (int i = 0; i < files.size(); ++i) {
+        QFile::remove(folder + "/" + files.at(i));
+    }
+    QDir().rmdir(folder);
+    QFile::remove(catalog);
+
+    // parsed is what the catalog could not vouch for, all files cold and none warm
+    yellowRegistryStats system = Yellow::registryStats();
+    QString output = "{\"profiles\":" + QString::number(BENCH_PROFILE_COPIES);
+    output.append(",\"cold_parsed\":" + QString::number(coldStats.parsed));
+    output.append(",\"warm_parsed\":" + QString::number(warmStats.parsed));
+    output.append(",\"system_profiles\":" + QString::number(system.total));
+    output.append(",\"system_parsed\":" + QString::number(system.parsed));
+    output.append(",\"system_msec\":" + QString::number(system.msec));
+    output.append(",\"phases\":[" + benchPhaseJson(cold) + "," + benchPhaseJson(warm) + "," + benchPhaseJson(registry) + "]}");
+    return output;
+}
+
+// every generated image through the headless pipeline to sRGB
+static QString benchBatch(QList<benchCase> images, benchOptions options)
+{
+    cyanBatchOptions batch;
+    batch.outputDir = options.folder + "/batch";
+    QDir().mkpath(batch.outputDir);
+    batch.outputProfile = benchProfile(1);
+    batch.edit.brightness = 100;
+    batch.edit.saturation = 100;
+    batch.edit.hue = 100;
+    batch.edit.intent = 2;
+    batch.edit.black = false;
+    batch.threads = 0;
+    batch.queue = CYAN_STAGE_QUEUE;
+    batch.overwrite = true;
+    batch.workers[CYAN_STAGE_READ] = 1;
+    batch.workers[CYAN_STAGE_DECODE] = 2;
+    batch.workers[CYAN_STAGE_TRANSFORM] = 1;
+    batch.workers[CYAN_STAGE_ENCODE] = 2;
+    benchPhase phase;
+    phase.name = "batch";
+    phase.pixels = 0;
+    phase.bytes = 0;
+    phase.rss = 0;
+    for (int i = 0; i < images.size(); ++i) {
+        if (images.at(i).error.isEmpty()) {
+            batch.files << images.at(i).file;
+            phase.pixels += (qint64)images.at(i).width*images.at(i).height;
+            phase.bytes += images.at(i).fileBytes;
+        }
+    }
+
+    QElapsedTimer timer;
+    bool peak = benchResetPeak();
+    timer.start();
+    CyanPipeline pipeline;
+    pipeline.start(batch);
+    int failed = 0;
+    cyanBatchResult result;
+    while (pipeline.nextResult(&result)) {
+        if (!result.ok) {
+            failed++;
+        }
+        QFile::remove(result.output);
+    }
+    pipeline.wait();
+    benchRecord(&phase, timer.nsecsElapsed()/1000, peak);
+    QDir().rmdir(batch.outputDir);
+    return "{\"files\":" + QString::number(batch.files.size()) + ",\"failed\":" + QString::number(failed) + ",\"phase\":" + benchPhaseJson(phase) + ",\"stages\":" + CyanBatch::jsonStats(pipeline.stats(), batch.files.size(), failed, timer.elapsed()) + "}";
+}
+
+static QString benchUsage()
+{
+    QString text;
+    text.append("Usage: cyan-bench [options]\n\n");
+    text.append("  --sizes <n,n>       square image sizes, default 512,2048\n");
+    text.append("  --threads <n,n>     thread counts for the thread sweep, default 1, 2, 4 .. 32 (up to the cores) and all cores\n");
+    text.append("  --iterations <n>    runs per phase, the median is reported, default 3\n");
+    text.append("  --no-lut            disable the Black lookup tables\n");
+    text.append("  --keep              keep the generated files\n");
+    text.append("  -o <file>           write JSON to file instead of stdout\n");
+    return text;
+}
+
+static QList<int> benchList(QString value)
+{
+    QList<int> output;
+    QStringList items = value.split(",");
+    for (int i = 0; i < items.size(); ++i) {
+        int number = items.at(i).toInt();
+        if (number > 0) {
+            output << number;
+        }
+    }
+    return output;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("Cyan");
+    QCoreApplication::setOrganizationName("Cyan");
+    QCoreApplication::setApplicationVersion(CYAN_VERSION);
+
+    benchOptions options;
+    options.sizes << 512 << 2048;
+    // powers of two up to 32 that the cores can run, and all cores
+    int cores = qMax(1, QThread::idealThreadCount());
+    for (int count = 1; count <= qMin(cores, 32); count *= 2) {
+        options.threads << count;
+    }
+    if (!options.threads.contains(cores)) {
+        options.threads << cores;
+    }
+    options.iterations = 3;
+    options.lookupTables = true;
+    options.keep = false;
+
+    QStringList args = a.arguments();
+    for (int i = 1; i < args.size(); ++i) {
+        QString arg = args.at(i);
+        bool hasValue = i+1 < args.size();
+        if (arg == "--sizes" && hasValue) {
+            options.sizes = benchList(args.at(++i));
+        } else if (arg == "--threads" && hasValue) {
+            options.threads = benchList(args.at(++i));
+        } else if (arg == "--iterations" && hasValue) {
+            options.iterations = qMax(1, args.at(++i).toInt());
+        } else if (arg == "-o" && hasValue) {
+            options.output = args.at(++i);
+        } else if (arg == "--no-lut") {
+            options.lookupTables = false;
+        } else if (arg == "--keep") {
+            options.keep = true;
+        } else {
+            QTextStream(stderr) << benchUsage();
+            return arg=="--help"?CYAN_EXIT_OK:CYAN_EXIT_USAGE;
+        }
+    }
+    if (options.sizes.isEmpty() || options.threads.isEmpty()) {
+        QTextStream(stderr) << benchUsage();
+        return CYAN_EXIT_USAGE;
+    }
+
+    options.folder = QDir::tempPath() + "/cyan-bench-" + QString::number(QCoreApplication::applicationPid());
+    QDir().mkpath(options.folder);
+    // the genProfiles phase must not rewrite the catalog of the user's own Cyan
+    Yellow::setCatalogFile(options.folder + "/registry.catalog");
+    Black::setLookupTables(options.lookupTables);
+    Black::setThreads(options.threads.last());
+
+    Magenta proc;
+    QElapsedTimer total;
+    total.start();
+
+    // PNG has no CMYK or float, JPEG is 8-bit only
+    QList<benchCase> images;
+    QStringList formats;
+    formats << "png" << "jpg" << "tif";
+    for (int s = 0; s < options.sizes.size(); ++s) {
+        for (int f = 0; f < formats.size(); ++f) {
+            for (int colorspace = 1; colorspace <= 3; ++colorspace) {
+                for (int depth = 8; depth <= 32; depth *= 2) {
+                    if ((formats.at(f) == "png" && (colorspace == 2 || depth == 32)) || (formats.at(f) == "jpg" && depth != 8)) {
+                        continue;
+                    }
+                    benchCase image;
+                    image.format = formats.at(f);
+                    image.colorspace = colorspace;
+                    image.depth = depth;
+                    image.width = options.sizes.at(s);
+                    image.height = options.sizes.at(s);
+                    image.fileBytes = 0;
+                    try {
+                        benchImage(&image, options.folder);
+                    }
+                    catch(Magick::Error &error_ ) {
+                        image.error = error_.what();
+                    }
+                    catch(Magick::Warning &warn_ ) {
+                        image.error = warn_.what();
+                    }
+                    if (image.error.isEmpty()) {
+                        benchRun(&image, options, &proc);
+                    }
+                    images << image;
+                }
+            }
+        }
+    }
+
+    QString json = "{\"cyan\":" + Magenta::jsonString(QCoreApplication::applicationVersion());
+    json.append(",\"threads\":" + QString::number(Black::threads()));
+    json.append(",\"lookup_tables\":" + QString(options.lookupTables?"true":"false"));
+    json.append(",\"iterations\":" + QString::number(options.iterations));
+    json.append(",\"images\":[");
+    for (int i = 0; i < images.size(); ++i) {
+        benchCase image = images.at(i);
+        if (i > 0) {
+            json.append(",");
+        }
+        json.append("\n{\"format\":" + Magenta::jsonString(image.format));
+        json.append(",\"colorspace\":" + Magenta::jsonString(benchColorspace(image.colorspace)));
+        json.append(",\"depth\":" + QString::number(image.depth));
+        json.append(",\"width\":" + QString::number(image.width));
+        json.append(",\"height\":" + QString::number(image.height));
+        json.append(",\"file_bytes\":" + QString::number(image.fileBytes));
+        if (!image.error.isEmpty()) {
+            json.append(",\"error\":" + Magenta::jsonString(image.error.trimmed()));
+        }
+        json.append(",\"phases\":[");
+        for (int p = 0; p < image.phases.size(); ++p) {
+            json.append((p>0?",":"") + benchPhaseJson(image.phases.at(p)));
+        }
+        json.append("]}");
+    }
+    json.append("]");
+    json.append(",\n\"batch\":" + benchBatch(images, options));
+    json.append(",\n\"thread_sweep\":" + benchThreads(options));
+    json.append(",\n\"profiles\":" + benchProfiles(options));
+    json.append(",\n\"msec\":" + QString::number(total.elapsed()));
+    json.append(",\"peak_rss_kb\":" + QString::number(benchProcessPeak()));
+    json.append("}\n");
+
+    if (!options.keep) {
+        for (int i = 0; i < images.size(); ++i) {
+            QFile::remove(images.at(i).file);
+            QFile::remove(QFileInfo(images.at(i).file).absolutePath() + "/saved-" + QFileInfo(images.at(i).file).completeBaseName() + ".tif");
+        }
+        QFile::remove(Yellow::catalogFile());
+        QDir().rmdir(options.folder);
+    }
+
+    if (options.output.isEmpty()) {
+        QTextStream(stdout) << json;
+    } else if (!benchWriteFile(options.output, json.toUtf8())) {
+        QTextStream(stderr) << "Unable to write " << options.output << "\n";
+        return CYAN_EXIT_FAILED;
+    }
+    return CYAN_EXIT_OK;
+}
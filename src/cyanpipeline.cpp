@@ -0,0 +1,329 @@
+/*
+* Cyan <https://github.com/olear/cyan>,
+* Copyright (C) 2016 Ole-André Rodlie
+*
+* Cyan is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License version 2 as published
+* by the Free Software Foundation.
+*
+* Cyan is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Cyan.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+*/
+
+#include "cyanpipeline.h"
+#include "magentatiff.h"
+#include <QFileInfo>
+#include <QDir>
+#include <QHash>
+
+void CyanStageThread::run()
+{
+    owner->runStage(index);
+}
+
+CyanPipeline::CyanPipeline(QObject *parent) :
+    QObject(parent)
+    , wallTime(0)
+{
+    for (int i = 0; i <= CYAN_STAGE_STREAM; ++i) {
+        busy[i] = 0;
+        items[i] = 0;
+    }
+}
+
+CyanPipeline::~CyanPipeline()
+{
+    wait();
+}
+
+void CyanPipeline::start(cyanBatchOptions options)
+{
+    batch = options;
+    wall.start();
+
+    // the read stage takes its jobs from a pre-filled queue, the results queue holds
+    // finished jobs only, so neither needs a bound
+    queues[CYAN_STAGE_READ].setCapacity(qMax(1, batch.files.size()));
+    results.setCapacity(qMax(1, batch.files.size()));
+    // outputs are named after the input, the first file claims a name (scan.png and
+    // scan.jpg, or scan.png from two folders) so two encode workers never write the same file
+    QHash<QString, QString> claimed;
+    for (int i = 0; i < batch.files.size(); ++i) {
+        cyanBatchJob *job = new cyanBatchJob();
+        job->file = batch.files.at(i);
+        job->output = outputFile(job->file, batch.outputDir);
+        QString name = job->output;
+#if defined(Q_OS_WIN) || defined(Q_OS_MAC)
+        name = name.toLower(); // case insensitive file systems
+#endif
+        if (claimed.contains(name)) {
+            job->error = tr("Output is also the output of %1").arg(claimed.value(name));
+        } else {
+            claimed.insert(name, job->file);
+        }
+        job->timer.start();
+        queues[CYAN_STAGE_READ].push(job);
+    }
+    queues[CYAN_STAGE_READ].done();
+
+    for (int stage = 0; stage < CYAN_STAGES; ++stage) {
+        batch.workers[stage] = qMax(1, batch.workers[stage]);
+        if (stage > 0) {
+            queues[stage].setCapacity(batch.queue);
+            queues[stage].setProducers(batch.workers[stage-1]);
+        }
+    }
+    results.setProducers(batch.workers[CYAN_STAGE_ENCODE]);
+
+    for (int stage = 0; stage < CYAN_STAGES; ++stage) {
+        for (int i = 0; i < batch.workers[stage]; ++i) {
+            CyanStageThread *thread = new CyanStageThread(this, stage);
+            threads << thread;
+            thread->start();
+        }
+    }
+}
+
+bool CyanPipeline::nextResult(cyanBatchResult *result)
+{
+    return results.pop(result);
+}
+
+void CyanPipeline::wait()
+{
+    for (int i = 0; i < threads.size(); ++i) {
+        threads.at(i)->wait();
+        delete threads.at(i);
+    }
+    if (!threads.isEmpty()) {
+        wallTime = wall.nsecsElapsed()/1000;
+    }
+    threads.clear();
+}
+
+QList<cyanStageStats> CyanPipeline::stats()
+{
+    QList<cyanStageStats> output;
+    QMutexLocker lock(&statsMutex);
+    qint64 elapsed = wallTime>0?wallTime:wall.nsecsElapsed()/1000;
+    for (int stage = 0; stage <= CYAN_STAGE_STREAM; ++stage) {
+        cyanStageStats stat;
+        stat.name = stageName(stage);
+        // streamed files share the encode workers, the read queue is filled up front
+        stat.workers = batch.workers[qMin(stage, (int)CYAN_STAGE_ENCODE)];
+        stat.items = items[stage];
+        stat.peakQueue = (stage == CYAN_STAGE_READ || stage == CYAN_STAGE_STREAM)?-1:queues[stage].peakSize();
+        stat.busy = busy[stage];
+        stat.utilization = elapsed>0?(double)busy[stage]/((double)elapsed*stat.workers):0;
+        output << stat;
+    }
+    return output;
+}
+
+void CyanPipeline::runStage(int stage)
+{
+    cyanBatchJob *job = 0;
+    while (queues[stage].pop(&job)) {
+        QElapsedTimer timer;
+        timer.start();
+        if (job->error.isEmpty()) {
+            switch (stage) {
+            case CYAN_STAGE_READ:
+                readJob(job);
+                break;
+            case CYAN_STAGE_DECODE:
+                decodeJob(job);
+                break;
+            case CYAN_STAGE_TRANSFORM:
+                transformJob(job);
+                break;
+            case CYAN_STAGE_ENCODE:
+                encodeJob(job);
+                break;
+            }
+        }
+        qint64 elapsed = timer.nsecsElapsed()/1000;
+        // streamed files skip decode and transform, their whole conversion is the stream stage
+        int account = stage;
+        if (job->useStream && stage == CYAN_STAGE_ENCODE) {
+            account = CYAN_STAGE_STREAM;
+        }
+        if (!job->useStream || stage == CYAN_STAGE_READ || stage == CYAN_STAGE_ENCODE) {
+            statsMutex.lock();
+            busy[account] += elapsed;
+            items[account]++;
+            statsMutex.unlock();
+        }
+
+        // time spent blocked on a full queue is backpressure, not work
+        if (stage+1 < CYAN_STAGES) {
+            queues[stage+1].push(job);
+        } else {
+            cyanBatchResult result;
+            result.file = job->file;
+            result.output = job->output;
+            result.error = job->error;
+            result.warning = job->warning;
+            result.ok = job->error.isEmpty();
+            result.msec = job->timer.elapsed();
+            delete job;
+            results.push(result);
+        }
+    }
+    if (stage+1 < CYAN_STAGES) {
+        queues[stage+1].done();
+    } else {
+        results.done();
+    }
+}
+
+void CyanPipeline::readJob(cyanBatchJob *job)
+{
+    QFileInfo imageFile(job->file);
+    if (!imageFile.isFile()) {
+        job->error = tr("No such file");
+    } else if (imageFile.absoluteFilePath() == job->output) {
+        job->error = tr("Output would replace the input file");
+    } else if (QFileInfo(job->output).exists() && !batch.overwrite) {
+        job->error = tr("Output exists, use --overwrite");
+    } else if (magentaTiff::canRead(job->file)) {
+        job->useStream = true;
+    } else {
+        job->source = Magenta::mapSource(job->file);
+        if (job->source.isNull()) {
+            job->error = tr("Unable to read file");
+        }
+    }
+}
+
+void CyanPipeline::decodeJob(cyanBatchJob *job)
+{
+    if (job->useStream) {
+        return;
+    }
+    try {
+        Magick::Image image = Magenta::readSource(job->source);
+        job->source = magentaSource();
+        job->inputProfile = batch.inputProfile;
+        if (job->inputProfile.isEmpty()) {
+            job->inputProfile = QByteArray((char*)image.iccColorProfile().data(), image.iccColorProfile().length());
+        }
+        int colorspace = Magenta::imageColorspace(image);
+        if (colorspace == 0) {
+            job->error = tr("Unsupported image colorspace");
+            return;
+        }
+        if (job->inputProfile.isEmpty()) {
+            Yellow yellow;
+            job->inputProfile = yellow.profileDefault(colorspace);
+        }
+        if (job->inputProfile.isEmpty() && batch.deviceLink.isEmpty()) {
+            job->error = tr("No input profile, the image has none and no default is set");
+            return;
+        }
+        // floating point, alpha and oversize sources are converted by ImageMagick, same as Magenta::saveImage
+        bool legacy = Magenta::needsLegacy(image);
+        if (legacy && !batch.deviceLink.isEmpty()) {
+            job->error = tr("Device links need an 8 or 16-bit image without alpha under %1 MB").arg(BLACK_MAX_BYTES/1024/1024);
+        } else if (legacy) {
+            job->legacy = image;
+            job->useLegacy = true;
+        } else {
+            job->tags = Magenta::imageTags(image);
+            job->image = Magenta::decodePixels(image);
+        }
+    }
+    catch(Magick::Error &error_ ) {
+        job->error.append(error_.what());
+    }
+    catch(Magick::Warning &warn_ ) {
+        job->error.append(warn_.what());
+    }
+}
+
+void CyanPipeline::transformJob(cyanBatchJob *job)
+{
+    if (job->useStream) {
+        return;
+    }
+    if (job->useLegacy) {
+        try {
+            Magenta::profileImage(job->legacy, job->inputProfile, batch.outputProfile, batch.edit);
+        }
+        catch(Magick::Error &error_ ) {
+            job->error.append(error_.what());
+        }
+        catch(Magick::Warning &warn_ ) {
+            job->warning.append(warn_.what());
+        }
+        return;
+    }
+    QList<QByteArray> profiles;
+    Black black;
+    if (!batch.deviceLink.isEmpty()) {
+        // one precomputed step, the link already holds both profiles, intent and BPC
+        if (black.profileColorSpace(batch.deviceLink) != job->image.colorspace) {
+            job->error = tr("The device link does not match the image colorspace");
+            return;
+        }
+        profiles << batch.deviceLink;
+    } else {
+        profiles << job->inputProfile << batch.outputProfile;
+    }
+    job->image = black.convertImage(job->image, profiles, job->image.depth, batch.edit.intent, batch.edit.black, &job->error);
+}
+
+void CyanPipeline::encodeJob(cyanBatchJob *job)
+{
+    if (job->useStream) {
+        if (!batch.deviceLink.isEmpty()) {
+            Magenta::streamImage(job->file, job->output, QByteArray(), batch.deviceLink, batch.edit, &job->error, batch.outputProfile);
+        } else {
+            Magenta::streamImage(job->file, job->output, batch.inputProfile, batch.outputProfile, batch.edit, &job->error);
+        }
+        return;
+    }
+    try {
+        if (job->useLegacy) {
+            Magenta::writeImage(job->legacy, job->output);
+            job->legacy = Magick::Image();
+        } else {
+            Magenta::encodeImage(job->output, job->image, batch.outputProfile, job->tags, &job->error);
+            job->image = blackImage();
+        }
+    }
+    catch(Magick::Error &error_ ) {
+        job->error.append(error_.what());
+    }
+    catch(Magick::Warning &warn_ ) {
+        job->warning.append(warn_.what());
+    }
+}
+
+QString CyanPipeline::stageName(int stage)
+{
+    switch (stage) {
+    case CYAN_STAGE_READ:
+        return "read";
+    case CYAN_STAGE_DECODE:
+        return "decode";
+    case CYAN_STAGE_TRANSFORM:
+        return "transform";
+    case CYAN_STAGE_ENCODE:
+        return "encode";
+    case CYAN_STAGE_STREAM:
+        return "stream";
+    }
+    return QString();
+}
+
+QString CyanPipeline::outputFile(QString file, QString folder)
+{
+    QFileInfo imageFile(file);
+    return QDir(folder).absoluteFilePath(imageFile.completeBaseName() + ".tif");
+}
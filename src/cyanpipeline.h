@@ -0,0 +1,201 @@
+/*
+* Cyan <https://github.com/olear/cyan>,
+* Copyright (C) 2016 Ole-André Rodlie
+*
+* Cyan is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License version 2 as published
+* by the Free Software Foundation.
+*
+* Cyan is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Cyan.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+*/
+
+#ifndef CYANPIPELINE_H
+#define CYANPIPELINE_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QList>
+#include <QQueue>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+#include <QThread>
+#include <QElapsedTimer>
+
+#include "magenta.h"
+
+#define CYAN_STAGE_READ 0
+#define CYAN_STAGE_DECODE 1
+#define CYAN_STAGE_TRANSFORM 2
+#define CYAN_STAGE_ENCODE 3
+#define CYAN_STAGES 4
+// streamed TIFF files, converted band by band on the encode workers
+#define CYAN_STAGE_STREAM 4
+#define CYAN_STAGE_QUEUE 2
+
+struct cyanBatchOptions {
+    QStringList files;
+    QString outputDir;
+    QString inputProfileFile;
+    QString outputProfileFile;
+    QString deviceLinkFile;
+    QByteArray inputProfile;
+    QByteArray outputProfile;
+    // replaces the input and output profiles in the conversion, outputProfile is only embedded
+    QByteArray deviceLink;
+    magentaAdjust edit;
+    int threads;
+    int workers[CYAN_STAGES];
+    int queue;
+    bool overwrite;
+};
+
+struct cyanBatchResult {
+    QString file;
+    QString output;
+    QString error;
+    QString warning;
+    qint64 msec;
+    bool ok;
+};
+
+// one file on its way through the pipeline, a job with an error skips the remaining stages
+// TIFF files libtiff can read are streamed, they pass decode and transform untouched and
+// are converted band by band by an encode worker, their time is reported as the stream stage
+struct cyanBatchJob {
+    QString file;
+    QString output;
+    magentaSource source;
+    blackImage image;
+    magentaTiffTags tags;
+    QByteArray inputProfile;
+    Magick::Image legacy;
+    bool useLegacy;
+    bool useStream;
+    QString error;
+    QString warning;
+    QElapsedTimer timer;
+    cyanBatchJob() : useLegacy(false), useStream(false) {}
+};
+
+struct cyanStageStats {
+    QString name;
+    int workers;
+    int items;
+    int peakQueue; // -1 when the stage has no input queue of its own
+    qint64 busy; // usec
+    double utilization;
+};
+
+// bounded FIFO between two stages, push blocks while full, pop blocks while empty
+// and returns false once every producer is done and the queue is drained
+template <typename T>
+class CyanQueue
+{
+public:
+    explicit CyanQueue(int capacity = CYAN_STAGE_QUEUE) : limit(qMax(1, capacity)), producers(1), peak(0) {}
+    void setCapacity(int capacity) { QMutexLocker lock(&mutex); limit = qMax(1, capacity); }
+    void setProducers(int count) { QMutexLocker lock(&mutex); producers = count; }
+    void push(T item)
+    {
+        QMutexLocker lock(&mutex);
+        while (items.size() >= limit) {
+            notFull.wait(&mutex);
+        }
+        items.enqueue(item);
+        peak = qMax(peak, items.size());
+        notEmpty.wakeOne();
+    }
+    bool pop(T *item)
+    {
+        QMutexLocker lock(&mutex);
+        while (items.isEmpty() && producers > 0) {
+            notEmpty.wait(&mutex);
+        }
+        if (items.isEmpty()) {
+            return false;
+        }
+        *item = items.dequeue();
+        notFull.wakeOne();
+        return true;
+    }
+    void done()
+    {
+        QMutexLocker lock(&mutex);
+        producers--;
+        if (producers <= 0) {
+            notEmpty.wakeAll();
+        }
+    }
+    int peakSize() { QMutexLocker lock(&mutex); return peak; }
+
+private:
+    QMutex mutex;
+    QWaitCondition notEmpty;
+    QWaitCondition notFull;
+    QQueue<T> items;
+    int limit;
+    int producers;
+    int peak;
+};
+
+class CyanPipeline;
+
+class CyanStageThread : public QThread
+{
+public:
+    CyanStageThread(CyanPipeline *pipeline, int stage) : owner(pipeline), index(stage) {}
+
+protected:
+    void run();
+
+private:
+    CyanPipeline *owner;
+    int index;
+};
+
+// read -> decode -> transform -> encode, each stage has its own workers, the bounded
+// queues between them keep at most queue+workers images in flight per stage
+class CyanPipeline : public QObject
+{
+    Q_OBJECT
+public:
+    explicit CyanPipeline(QObject *parent = 0);
+    ~CyanPipeline();
+
+public slots:
+    void start(cyanBatchOptions options);
+    bool nextResult(cyanBatchResult *result);
+    void wait();
+    QList<cyanStageStats> stats();
+    void runStage(int stage);
+
+public:
+    static QString stageName(int stage);
+    static QString outputFile(QString file, QString folder);
+
+private:
+    cyanBatchOptions batch;
+    QList<CyanStageThread*> threads;
+    CyanQueue<cyanBatchJob*> queues[CYAN_STAGES];
+    CyanQueue<cyanBatchResult> results;
+    QMutex statsMutex;
+    qint64 busy[CYAN_STAGES+1];
+    int items[CYAN_STAGES+1];
+    QElapsedTimer wall;
+    qint64 wallTime;
+    void readJob(cyanBatchJob *job);
+    void decodeJob(cyanBatchJob *job);
+    void transformJob(cyanBatchJob *job);
+    void encodeJob(cyanBatchJob *job);
+};
+
+#endif // CYANPIPELINE_H
@@ -16,10 +16,30 @@
 */
 
 #include "magenta.h"
+#include "magentatiff.h"
+#include "magentajpeg.h"
+#include "magentaprobe.h"
 #include <QCoreApplication>
+#include <QFileInfo>
+#include <cstring>
+#include <cmath>
+
+static std::string magentaMap(int colorspace)
+{
+    switch (colorspace) {
+    case 2:
+        return "CMYK";
+    case 3:
+        return "I";
+    }
+    return "RGB";
+}
 
 Magenta::Magenta(QObject *parent) :
     QObject(parent)
+    , workingDepth(0)
+    , workingScale(1)
+    , workingLegacy(false)
 {
     Magick::InitializeMagick(NULL);
     moveToThread(&t);
@@ -32,134 +52,721 @@ Magenta::~Magenta()
     t.wait();
 }
 
-void Magenta::requestImage(bool isPreview, bool doSave, QString file, QByteArray data, QByteArray inprofile, QByteArray outprofile, QByteArray monitorprofile, magentaAdjust edit)
+void Magenta::requestImage(bool isPreview, bool doSave, QString file, magentaSource data, QByteArray inprofile, QByteArray outprofile, QByteArray monitorprofile, magentaAdjust edit)
+{
+    // a new preview or document supersedes every preview still queued or running
+    int generation = 0;
+    if (!doSave) {
+        generation = latest.fetchAndAddOrdered(1)+1;
+    }
+    QMetaObject::invokeMethod(this,"readImage", Q_ARG(bool, isPreview), Q_ARG(bool, doSave), Q_ARG(QString, file), Q_ARG(magentaSource, data), Q_ARG(QByteArray, inprofile), Q_ARG(QByteArray, outprofile), Q_ARG(QByteArray, monitorprofile), Q_ARG(magentaAdjust, edit), Q_ARG(int, generation));
+}
+
+int Magenta::currentGeneration()
+{
+    return latest.fetchAndAddRelaxed(0);
+}
+
+blackCancel Magenta::generationCancel(int generation)
 {
-    QMetaObject::invokeMethod(this,"readImage", Q_ARG(bool, isPreview), Q_ARG(bool, doSave), Q_ARG(QString, file), Q_ARG(QByteArray, data), Q_ARG(QByteArray, inprofile), Q_ARG(QByteArray, outprofile), Q_ARG(QByteArray, monitorprofile), Q_ARG(magentaAdjust, edit));
+    // for work outside Magenta that belongs to a preview, stops with it
+    return blackCancel(&latest, generation);
 }
 
-magentaImage Magenta::readImage(bool isPreview, bool doSave, QString file, QByteArray data, QByteArray inprofile, QByteArray outprofile, QByteArray monitorprofile, magentaAdjust edit)
+magentaImage Magenta::readImage(bool isPreview, bool doSave, QString file, magentaSource data, QByteArray inprofile, QByteArray outprofile, QByteArray monitorprofile, magentaAdjust edit, int generation)
 {
+    QElapsedTimer timer;
+    timer.start();
     magentaImage result;
-    Magick::Blob outputImage;
+    result.generation = generation;
+    result.job = doSave?"save":(isPreview?"preview":"open");
+    blackCancel cancel;
+    if (isPreview && generation > 0) {
+        cancel = blackCancel(&latest, generation);
+        if (cancel.cancelled()) {
+            return result;
+        }
+    }
+    result.preview = isPreview;
+    result.saved = false;
+    result.colorspace = 0;
+    result.width = 0;
+    result.height = 0;
+    result.memory = 0;
+    result.scale = 1;
     QByteArray outputProfile;
-    int outputColorSpace;
-    Magick::Image image;
     try {
-        if (!file.isEmpty() && !doSave ) {
-            image.read(file.toUtf8().data());
-        } else {
-            Magick::Blob imageData(data.data(),data.length());
-            image.read(imageData);
+        // opening a document always invalidates the retained working image
+        if (!isPreview && !doSave) {
+            releaseImage();
+            // decode straight from the mapped file, the encoded bytes are never copied
+            magentaSource source = data;
+            if (source.isNull() && !file.isEmpty()) {
+                source = mapSource(file);
+            }
+            if (!source.isNull()) {
+                // a zoomed out view of a JPEG only needs a reduced decode, the full image
+                // waits until a closer view or a save needs it
+                loadImage(source, magentaJpeg::scaleFor(edit.zoom), &result);
+            } else {
+                Magick::Image image;
+                image.read(file.toUtf8().data());
+                addTiming(&result, "decode", &timer, QFileInfo(file).size());
+                decodeImage(image);
+                addTiming(&result, "unpack", &timer, working.pixels.size());
+            }
+            workingFile = file;
+            if (workingLegacy || workingScale > 1) {
+                workingSource = source;
+            }
+            if (working.isNull()) {
+                result.error.append(tr("Unsupported image colorspace"));
+            }
+        } else if (working.isNull() && !data.isNull()) {
+            loadImage(data, 1, &result);
         }
 
-        switch(image.colorSpace()) {
-        case Magick::CMYKColorspace:
-            outputColorSpace=2;
-            break;
-        case Magick::GRAYColorspace:
-            outputColorSpace=3;
-            break;
-        case Magick::RGBColorspace:
-            outputColorSpace=1;
-            break;
-        case Magick::sRGBColorspace:
-            outputColorSpace=1;
-            break;
-        case Magick::TransparentColorspace:
-            outputColorSpace=1;
-            break;
-        default:
-            outputColorSpace=0;
-        }
-        result.colorspace = outputColorSpace;
-
-        result.width = (int)image.columns();
-        result.height = (int)image.rows();
-
-        if (edit.intent > 0) {
-            switch(edit.intent) {
-            case 1:
-                image.renderingIntent(Magick::SaturationIntent);
-                break;
-            case 2:
-                image.renderingIntent(Magick::PerceptualIntent);
-                break;
-            case 3:
-                image.renderingIntent(Magick::AbsoluteIntent);
-                break;
+        int scale = magentaJpeg::scaleFor(doSave?0:edit.zoom);
+        if (workingScale > 1 && scale < workingScale && !workingSource.isNull()) {
+            loadImage(workingSource, scale, &result);
+        }
+        timer.restart();
+
+        if (working.isNull()) {
+            if (result.error.isEmpty()) {
+                result.error.append(tr("No image loaded"));
+            }
+        } else {
+            blackImage source = working;
+            bool modulate = edit.brightness!=100 || edit.saturation!=100 || edit.hue!=100;
+            bool preview = isPreview && !doSave;
+            // previews modulate after the quick pass
+            if (modulate && !preview) {
+                source = modulateImage(source, edit);
+                addTiming(&result, "modulate", &timer, source.pixels.size());
+            }
+            result.colorspace = source.colorspace;
+            result.width = workingSize.width();
+            result.height = workingSize.height();
+            result.scale = workingScale;
+
+            if (!isPreview && !doSave) {
+                outputProfile = workingProfile;
+            } else if (isPreview && !doSave) {
+                result.transform = previewTransform(source, inprofile, outprofile, edit.proof?monitorprofile:QByteArray(), edit, &outputProfile);
+                if (outputProfile.isEmpty()) {
+                    outputProfile = inprofile;
+                } else {
+                    addTiming(&result, "transform", &timer, 0);
+                    if (!result.transform) {
+                        result.error.append(tr("Unable to create color transform"));
+                    }
+                }
+
+                // quick pass, a viewport sized copy is converted and sent ahead of the full result,
+                // sampled from the smallest pyramid level that is still large enough
+                if (edit.preview > 0 && qMax(working.width, working.height) > edit.preview && result.error.isEmpty()) {
+                    blackImage level = working;
+                    for (int i = 1; !modulate && i < workingLevels.size(); ++i) {
+                        if (qMax(workingLevels.at(i).width, workingLevels.at(i).height) < edit.preview) {
+                            break;
+                        }
+                        level = workingLevels.at(i);
+                    }
+                    blackImage small = black.sampleImage(level, edit.preview);
+                    if (modulate) {
+                        small = modulateImage(small, edit);
+                    }
+                    QImage image = black.displayImage(small, result.transform, QRect(0, 0, small.width, small.height), cancel);
+                    addTiming(&result, "quick", &timer, small.pixels.size());
+                    if (!image.isNull() && !cancel.cancelled()) {
+                        magentaImage first = result;
+                        first.job = "quick";
+                        first.quick = image;
+                        emit returnImage(first);
+                    }
+                }
+
+                // refinement, the viewer converts the visible tiles on demand with the
+                // transform, the pyramid is kept with the working image when unmodulated
+                if (modulate) {
+                    source = modulateImage(source, edit);
+                    addTiming(&result, "modulate", &timer, source.pixels.size());
+                    result.levels = previewLevels(source, QList<blackImage>(), cancel);
+                } else {
+                    workingLevels = previewLevels(working, workingLevels, cancel);
+                    result.levels = workingLevels;
+                }
+                addTiming(&result, "levels", &timer, 0);
+                result.source = source;
+            } else if (doSave) {
+                saveImage(file, source, inprofile, outprofile, edit, &result);
             }
         }
+    }
+    catch(Magick::Error &error_ ) {
+        result.error.append(error_.what());
+    }
+    catch(Magick::Warning &warn_ ) {
+        result.warning.append(warn_.what());
+    }
 
-        if (edit.black) {
-            image.blackPointCompensation(edit.black);
+    if (!doSave) {
+        if (outputProfile.length() > 0) {
+            result.profile = outputProfile;
+        } else {
+            result.profile = yellow.profileDefault(result.colorspace);
         }
+    }
 
-        if (edit.brightness!=100 || edit.saturation!=100 || edit.hue!=100) {
-            image.modulate(edit.brightness,edit.saturation,edit.hue);
+    if (!file.isEmpty()) {
+        result.filename = file;
+    }
+    result.memory = working.pixels.size();
+
+    if (cancel.cancelled()) {
+        return result;
+    }
+    emit returnImage(result);
+
+    // the other side of the proof toggle, built while the viewer shows the preview
+    if (isPreview && !doSave && edit.alternate && monitorprofile.length() > 0 && !result.source.isNull() && result.error.isEmpty()) {
+        QByteArray alternateProfile;
+        magentaImage alternate = result;
+        alternate.job = "alternate";
+        alternate.timings.clear();
+        timer.restart();
+        alternate.transform = previewTransform(result.source, inprofile, outprofile, edit.proof?QByteArray():monitorprofile, edit, &alternateProfile);
+        addTiming(&alternate, "alternate", &timer, 0);
+        if (alternate.transform && !cancel.cancelled()) {
+            emit returnImage(alternate);
         }
+    }
+    return result;
+}
+
+void Magenta::releaseImage()
+{
+    working = blackImage();
+    workingDepth = 0;
+    workingScale = 1;
+    workingLegacy = false;
+    workingTags = magentaTiffTags();
+    workingSize = QSize();
+    workingFile.clear();
+    workingSource = magentaSource();
+    workingProfile.clear();
+    workingLevels.clear();
+}
+
+void Magenta::decodeImage(Magick::Image &image)
+{
+    workingDepth = (int)image.depth();
+    workingProfile = QByteArray((char*)image.iccColorProfile().data(), image.iccColorProfile().length());
+    workingLegacy = needsLegacy(image);
+    workingTags = imageTags(image);
+    workingScale = 1;
+    workingSize = QSize((int)image.columns(), (int)image.rows());
+    blackImage format = imageFormat(image);
+    if (format.colorspace > 0 && !format.fits()) {
+        // too large to pack, the viewer gets a reduced copy and saves read the source again
+        int reduce = (int)ceil(sqrt((double)format.byteCount()/BLACK_MAX_BYTES));
+        Magick::Geometry reduced(qMax(1, format.width/reduce), qMax(1, format.height/reduce));
+        reduced.aspect(true);
+        image.sample(reduced);
+    }
+    working = decodePixels(image);
+}
 
-        if (inprofile.length() > 0) {
-            Magick::Blob sourceProfile(inprofile.data(), inprofile.length());
-            image.profile("ICC",sourceProfile); // use ICM in GM and ICC in IM
+void Magenta::loadImage(magentaSource source, int scale, magentaImage *result)
+{
+    QElapsedTimer timer;
+    timer.start();
+    workingLevels.clear();
+    if (scale > 1 && magentaJpeg::isJpeg(source.data(), source.size())) {
+        int width = 0;
+        int height = 0;
+        blackImage image = magentaJpeg::decode(source.data(), source.size(), scale, &width, &height, 0);
+        if (!image.isNull()) {
+            magentaInfo info;
+            magentaProbe::probeJpeg(reinterpret_cast<const uchar*>(source.data()), source.size(), &info);
+            working = image;
+            workingDepth = 8;
+            workingScale = scale;
+            workingLegacy = false;
+            // saves decode the file again at full size, with ImageMagick
+            workingTags = magentaTiffTags();
+            workingSize = QSize(width, height);
+            workingProfile = info.profile;
+            addTiming(result, "decode 1/" + QString::number(scale), &timer, source.size());
+            return;
         }
-        if (outprofile.length() > 0) {
-            Magick::Blob destProfile(outprofile.data(), outprofile.length());
-            image.profile("ICC",destProfile); // use ICM in GM and ICC in IM
+        // anything libjpeg does not decode cleanly is left to ImageMagick
+    }
+    Magick::Image image = readSource(source);
+    addTiming(result, "decode", &timer, source.size());
+    decodeImage(image);
+    addTiming(result, "unpack", &timer, working.pixels.size());
+}
+
+magentaSource Magenta::mapSource(QString file)
+{
+    magentaSource source;
+    source.file = file;
+    QSharedPointer<magentaMapping> mapping(new magentaMapping(file));
+    if (mapping->file.open(QIODevice::ReadOnly) && mapping->file.size() > 0) {
+        mapping->length = mapping->file.size();
+        mapping->bytes = mapping->file.map(0, mapping->length);
+    }
+    if (mapping->bytes) {
+        source.mapping = mapping;
+    }
+    return source;
+}
+
+Magick::Image Magenta::readSource(magentaSource source)
+{
+    // Magick::Blob copies its data, BlobToImage reads the mapping in place
+    MagickCore::ImageInfo *info = MagickCore::AcquireImageInfo();
+    QByteArray fileName = source.file.toUtf8();
+    strncpy(info->filename, fileName.constData(), sizeof(info->filename)-1);
+    // only the first frame is used, coders that can skip the others do
+    info->scene = 0;
+    info->number_scenes = 1;
+    MagickCore::ExceptionInfo *exception = MagickCore::AcquireExceptionInfo();
+    MagickCore::Image *image = MagickCore::BlobToImage(info, source.data(), (size_t)source.size(), exception);
+    MagickCore::DestroyImageInfo(info);
+
+    std::string message;
+    bool failed = exception->severity >= MagickCore::ErrorException || !image;
+    bool warned = exception->severity != MagickCore::UndefinedException && !failed;
+    if (exception->severity != MagickCore::UndefinedException) {
+        message = exception->reason?exception->reason:"";
+        if (exception->description) {
+            message += std::string(" (") + exception->description + ")";
         }
-        if (monitorprofile.length() > 0 && isPreview) {
-            Magick::Blob proofProfile(monitorprofile.data(), monitorprofile.length());
-            image.profile("ICC",proofProfile); // use ICM in GM and ICC in IM
+    }
+    MagickCore::DestroyExceptionInfo(exception);
+
+    if (failed) {
+        if (image) {
+            MagickCore::DestroyImageList(image);
         }
+        throw Magick::Error(message.empty()?std::string("Unable to read image"):message);
+    }
+    // drop the other frames of a multi-page file like Magick::Image::read does, they
+    // would stay in memory and the legacy writer would write them all back out
+    if (image->next) {
+        MagickCore::Image *next = image->next;
+        image->next = 0;
+        next->previous = 0;
+        MagickCore::DestroyImageList(next);
+    }
+    Magick::Image output(image);
+    if (warned) {
+        throw Magick::Warning(message);
+    }
+    return output;
+}
+
+int Magenta::imageColorspace(Magick::Image &image)
+{
+    switch(image.colorSpace()) {
+    case Magick::CMYKColorspace:
+        return 2;
+    case Magick::GRAYColorspace:
+        return 3;
+    case Magick::RGBColorspace:
+    case Magick::sRGBColorspace:
+    case Magick::TransparentColorspace:
+        return 1;
+    default:;
+    }
+    return 0;
+}
+
+blackImage Magenta::imageFormat(Magick::Image &image)
+{
+    // size and layout decodePixels packs the image in, no pixels
+    blackImage output;
+    output.colorspace = imageColorspace(image);
+    if (output.colorspace == 0) {
+        return output;
+    }
 
-        outputProfile = QByteArray((char*)image.iccColorProfile().data(), image.iccColorProfile().length());
+    // keep 8-bit sources at 8-bit, everything else is packed as 16-bit
+    output.width = (int)image.columns();
+    output.height = (int)image.rows();
+    output.depth = image.depth()>8?16:8;
+    return output;
+}
 
-        if (isPreview) {
-            result.preview = true;
-        }
-        else {
-            result.preview = false;
+bool Magenta::needsLegacy(Magick::Image &image)
+{
+    // the packed formats have no alpha channel
+#if MagickLibVersion >= 0x700
+    bool alpha = image.alpha();
+#else
+    bool alpha = image.matte();
+#endif
+    return alpha || image.depth() > 16 || !imageFormat(image).fits();
+}
+
+magentaTiffTags Magenta::imageTags(Magick::Image &image)
+{
+    magentaTiffTags tags;
+    switch (image.compressType()) {
+    case Magick::UndefinedCompression:
+    case Magick::NoCompression:
+        tags.compression = COMPRESSION_NONE;
+        break;
+    case Magick::LZWCompression:
+        tags.compression = COMPRESSION_LZW;
+        break;
+    case Magick::ZipCompression:
+        tags.compression = COMPRESSION_ADOBE_DEFLATE;
+        break;
+    case Magick::RLECompression:
+        tags.compression = COMPRESSION_PACKBITS;
+        break;
+    default:
+        // lossy or TIFF-less codecs, magentaTiff writes LZW instead
+        tags.compression = COMPRESSION_LZW;
+    }
+    // ImageMagick uses the horizontal predictor for 8 and 16-bit LZW and Deflate
+    if (tags.compression == COMPRESSION_LZW || tags.compression == COMPRESSION_ADOBE_DEFLATE) {
+        tags.predictor = PREDICTOR_HORIZONTAL;
+    }
+    if (image.xResolution() > 0 && image.yResolution() > 0) {
+        tags.xResolution = (float)image.xResolution();
+        tags.yResolution = (float)image.yResolution();
+        switch (image.resolutionUnits()) {
+        case Magick::PixelsPerInchResolution:
+            tags.resolutionUnit = RESUNIT_INCH;
+            break;
+        case Magick::PixelsPerCentimeterResolution:
+            tags.resolutionUnit = RESUNIT_CENTIMETER;
+            break;
+        default:
+            tags.resolutionUnit = RESUNIT_NONE;
         }
+    }
+    return tags;
+}
+
+blackImage Magenta::decodePixels(Magick::Image &image)
+{
+    blackImage output = imageFormat(image);
+    if (output.colorspace == 0 || !output.allocate()) {
+        return blackImage();
+    }
+    image.write(0, 0, output.width, output.height, magentaMap(output.colorspace), output.depth==16?Magick::ShortPixel:Magick::CharPixel, output.pixels.data());
+    return output;
+}
+
+blackImage Magenta::modulateImage(blackImage input, magentaAdjust edit)
+{
+    Magick::StorageType type = input.depth==16?Magick::ShortPixel:Magick::CharPixel;
+    Magick::Image image(input.width, input.height, magentaMap(input.colorspace), type, input.pixels.constData());
+    image.modulate(edit.brightness,edit.saturation,edit.hue);
+    blackImage output = input;
+    output.pixels.detach();
+    image.write(0, 0, output.width, output.height, magentaMap(output.colorspace), type, output.pixels.data());
+    return output;
+}
 
-        if (isPreview && !doSave) {
-            image.depth(8);
-            image.magick("TIF");
+QList<blackImage> Magenta::previewLevels(blackImage input, QList<blackImage> levels, blackCancel cancel)
+{
+    // halves from the last finished level, a cancelled run keeps the levels done so far
+    if (levels.isEmpty()) {
+        levels << input;
+    }
+    while (levels.size() < MAGENTA_PREVIEW_LEVELS && !cancel.cancelled()) {
+        blackImage half = black.halfImage(levels.last(), cancel);
+        if (half.isNull()) {
+            break;
         }
+        levels << half;
+    }
+    return levels;
+}
 
-        if (doSave) {
-            image.magick("TIF");
-            QString comment = QCoreApplication::applicationName() + " " + QCoreApplication::applicationVersion() + " https://github.com/olear/cyan";
-            image.comment(comment.toStdString());
-            image.write(file.toUtf8().data());
-            result.saved = true;
+blackTransform Magenta::previewTransform(blackImage source, QByteArray inprofile, QByteArray outprofile, QByteArray monitorprofile, magentaAdjust edit, QByteArray *profile)
+{
+    // previews use a single lcms transform (input->output->monitor), built as a
+    // proofing transform when an output profile is simulated on the monitor
+    QList<QByteArray> previewProfiles;
+    int proof = BLACK_PROOF_NONE;
+    bool link = black.isDeviceLink(outprofile);
+    if (inprofile.length() > 0 || link) {
+        if (link) {
+            // a device link replaces input and output, the result is shown through
+            // the default profile for its output colorspace
+            previewProfiles << outprofile;
+            QByteArray linkOutput = yellow.profileDefault(black.outputColorSpace(outprofile));
+            if (linkOutput.length() > 0) {
+                previewProfiles << linkOutput;
+            }
         } else {
-            result.saved = false;
-            image.strip();
-            image.write(&outputImage);
+            previewProfiles << inprofile;
+            if (outprofile.length() > 0) {
+                previewProfiles << outprofile;
+            }
+        }
+        if (monitorprofile.length() > 0) {
+            previewProfiles << monitorprofile;
+        }
+        if (black.profileColorSpace(previewProfiles.last()) != 1) {
+            previewProfiles << black.displayProfile();
+        }
+        if (outprofile.length() > 0 && !link && previewProfiles.size() == 3) {
+            proof = BLACK_PROOF_SOFT;
         }
     }
-    catch(Magick::Error &error_ ) {
-        result.error.append(error_.what());
+    if (previewProfiles.size() < 2) {
+        return blackTransform();
     }
-    catch(Magick::Warning &warn_ ) {
-        result.warning.append(warn_.what());
+    if (profile) {
+        *profile = previewProfiles.last();
     }
+    return black.displayTransform(source, previewProfiles, edit.intent, edit.black, proof);
+}
 
-    if (!doSave) {
-        if (outputImage.length() > 0) {
-            result.data = QByteArray((char*)outputImage.data(), outputImage.length());
+void Magenta::saveImage(QString file, blackImage source, QByteArray inprofile, QByteArray outprofile, magentaAdjust edit, magentaImage *result)
+{
+    QElapsedTimer timer;
+    timer.start();
+    if (workingLegacy) {
+        // floating point, alpha and oversize sources are not retained in full, convert
+        // from the source file
+        if (black.isDeviceLink(outprofile)) {
+            result->error.append(tr("Device links need an 8 or 16-bit image without alpha under %1 MB").arg(BLACK_MAX_BYTES/1024/1024));
+            return;
+        }
+        if (workingSource.isNull() && workingFile.isEmpty()) {
+            result->error.append(tr("The source image is no longer available"));
+            return;
+        }
+        Magick::Image image;
+        if (!workingSource.isNull()) {
+            image = readSource(workingSource);
+        } else {
+            image.read(workingFile.toUtf8().data());
+        }
+        addTiming(result, "decode", &timer, QFileInfo(workingFile).size());
+        if (edit.brightness!=100 || edit.saturation!=100 || edit.hue!=100) {
+            image.modulate(edit.brightness,edit.saturation,edit.hue);
+            addTiming(result, "modulate", &timer, 0);
         }
+        profileImage(image, inprofile, outprofile, edit);
+        addTiming(result, "convert", &timer, 0);
+        writeImage(image, file);
+        addTiming(result, "encode", &timer, QFileInfo(file).size());
+    } else {
+        QList<QByteArray> saveProfiles;
+        if (inprofile.length() > 0 && !black.isDeviceLink(outprofile)) {
+            saveProfiles << inprofile;
+        }
+        if (outprofile.length() > 0) {
+            saveProfiles << outprofile;
+        }
+        // converted and written a band at a time, no full size copy of the output
+        if (!streamImage(source, file, saveProfiles, edit, &result->error, workingTags)) {
+            return;
+        }
+        addTiming(result, "stream", &timer, QFileInfo(file).size());
+    }
+    result->saved = true;
+}
 
-        if (outputProfile.length() > 0) {
-            result.profile = QByteArray((char*)outputProfile.data(), outputProfile.length());
+void Magenta::addTiming(magentaImage *result, QString stage, QElapsedTimer *timer, qint64 bytes)
+{
+    magentaTiming timing;
+    timing.stage = stage;
+    timing.usec = timer->nsecsElapsed()/1000;
+    timing.bytes = bytes;
+    result->timings << timing;
+    timer->restart();
+}
+
+void Magenta::profileImage(Magick::Image &image, QByteArray inprofile, QByteArray outprofile, magentaAdjust edit)
+{
+    switch(edit.intent) {
+    case 1:
+        image.renderingIntent(Magick::SaturationIntent);
+        break;
+    case 2:
+        image.renderingIntent(Magick::PerceptualIntent);
+        break;
+    case 3:
+        image.renderingIntent(Magick::AbsoluteIntent);
+        break;
+    }
+    if (edit.black) {
+        image.blackPointCompensation(edit.black);
+    }
+    image.strip();
+    if (inprofile.length() > 0) {
+        Magick::Blob sourceProfile(inprofile.data(), inprofile.length());
+        image.profile("ICC",sourceProfile); // use ICM in GM and ICC in IM
+    }
+    if (outprofile.length() > 0) {
+        Magick::Blob destProfile(outprofile.data(), outprofile.length());
+        image.profile("ICC",destProfile); // use ICM in GM and ICC in IM
+    }
+}
+
+bool Magenta::encodeImage(QString file, blackImage output, QByteArray profile, magentaTiffTags tags, QString *error)
+{
+    // same file as the streamed saves, in one band
+    magentaTiff writer;
+    bool ok = writer.openWrite(file, output, profile, comment(), tags) && writer.writeRows(output);
+    if (!writer.close() || !ok) {
+        error->append(tr("Unable to write %1").arg(file));
+        QFile::remove(file);
+        return false;
+    }
+    return true;
+}
+
+void Magenta::writeImage(Magick::Image &image, QString file)
+{
+    image.magick("TIF");
+    image.comment(comment().toStdString());
+    image.write(file.toUtf8().data());
+}
+
+QString Magenta::comment()
+{
+    return QCoreApplication::applicationName() + " " + QCoreApplication::applicationVersion() + " https://github.com/olear/cyan";
+}
+
+QString Magenta::jsonString(QString value)
+{
+    QString output = "\"";
+    for (int i = 0; i < value.size(); ++i) {
+        QChar c = value.at(i);
+        if (c == '"' || c == '\\') {
+            output.append('\\').append(c);
+        } else if (c == '\n') {
+            output.append("\\n");
+        } else if (c == '\r') {
+            output.append("\\r");
+        } else if (c == '\t') {
+            output.append("\\t");
+        } else if (c.unicode() < 0x20) {
+            output.append(QString("\\u%1").arg(c.unicode(), 4, 16, QChar('0')));
         } else {
-            result.profile = yellow.profileDefault(outputColorSpace);
+            output.append(c);
         }
     }
+    output.append("\"");
+    return output;
+}
 
-    if (!file.isEmpty()) {
-        result.filename = file;
+bool Magenta::streamImage(QString input, QString file, QByteArray inprofile, QByteArray outprofile, magentaAdjust edit, QString *error, QByteArray embed)
+{
+    magentaTiff reader;
+    if (!reader.openRead(input)) {
+        error->append(tr("Unable to read file"));
+        return false;
+    }
+    Black black;
+    if (black.isDeviceLink(outprofile)) {
+        return streamRows(&reader, blackImage(), file, QList<QByteArray>() << outprofile, embed, edit, error);
+    }
+    if (inprofile.isEmpty()) {
+        inprofile = reader.profile();
+    }
+    if (inprofile.isEmpty()) {
+        Yellow yellow;
+        inprofile = yellow.profileDefault(reader.format().colorspace);
+    }
+    if (inprofile.isEmpty()) {
+        error->append(tr("No input profile, the image has none and no default is set"));
+        return false;
     }
+    QList<QByteArray> profiles;
+    profiles << inprofile;
+    if (outprofile.length() > 0) {
+        profiles << outprofile;
+    }
+    return streamRows(&reader, blackImage(), file, profiles, embed, edit, error);
+}
 
-    emit returnImage(result);
-    return result;
+bool Magenta::streamImage(blackImage source, QString file, QList<QByteArray> profiles, magentaAdjust edit, QString *error, magentaTiffTags tags)
+{
+    if (source.isNull()) {
+        error->append(tr("No image loaded"));
+        return false;
+    }
+    return streamRows(0, source, file, profiles, QByteArray(), edit, error, tags);
+}
+
+bool Magenta::streamRows(magentaTiff *reader, blackImage source, QString file, QList<QByteArray> profiles, QByteArray embed, magentaAdjust edit, QString *error, magentaTiffTags tags)
+{
+    // same output as encodeImage, the last profile is embedded (unless embed is given) and
+    // more than one profile or a device link means a conversion, a link is never embedded
+    // a TIFF source keeps its own compression and resolution, otherwise tags are written
+    Black black;
+    blackImage format = reader?reader->format():source;
+    format.pixels.clear();
+    bool link = !profiles.isEmpty() && black.isDeviceLink(profiles.last());
+    bool convert = profiles.size() > 1 || link;
+    if (link && profiles.size() == 1 && black.profileColorSpace(profiles.first()) != format.colorspace) {
+        error->append(tr("The device link does not match the image colorspace"));
+        return false;
+    }
+    blackImage outputFormat = format;
+    if (convert) {
+        outputFormat.colorspace = black.outputColorSpace(profiles.last());
+    }
+    if (embed.isEmpty() && !link && !profiles.isEmpty()) {
+        embed = profiles.last();
+    }
+    magentaTiff writer;
+    if (reader) {
+        tags = reader->tags();
+    }
+    if (!writer.openWrite(file, outputFormat, embed, comment(), tags)) {
+        error->append(tr("Unable to write %1").arg(file));
+        return false;
+    }
+
+    bool ok = true;
+    blackImage band;
+    int y = 0;
+    while (ok && y < format.height) {
+        int rows = qMin(MAGENTA_STREAM_ROWS, format.height-y);
+        if (reader) {
+            ok = reader->readRows(rows, &band);
+            if (!ok) {
+                error->append(tr("Unable to read file"));
+            }
+        } else {
+            band = format;
+            band.height = rows;
+            band.pixels = QByteArray::fromRawData(source.pixels.constData()+(qint64)y*source.bytesPerLine(), (int)(rows*source.bytesPerLine()));
+        }
+        blackImage output = band;
+        if (ok && convert) {
+            output = black.convertImage(band, profiles, band.depth, edit.intent, edit.black, error);
+            ok = !output.isNull();
+        }
+        if (ok) {
+            ok = writer.writeRows(output);
+            if (!ok) {
+                error->append(tr("Unable to write %1").arg(file));
+            }
+        }
+        y += rows;
+    }
+    if (!writer.close() && ok) {
+        error->append(tr("Unable to write %1").arg(file));
+        ok = false;
+    }
+    if (!ok) {
+        QFile::remove(file);
+    }
+    return ok;
 }
@@ -20,15 +20,49 @@
 
 #include <QObject>
 #include "yellow.h"
+#include "black.h"
+#include "magentatiff.h"
 #include <Magick++.h>
 #include <QByteArray>
 #include <QFile>
 #include <QDebug>
 #include <QStringList>
 #include <QThread>
+#include <QSharedPointer>
+#include <QElapsedTimer>
+#include <QSize>
+
+// pyramid levels prepared for the viewer, level 0 is the full image
+#define MAGENTA_PREVIEW_LEVELS 8
+
+// wall time and bytes handled by one step of a request
+struct magentaTiming {
+    QString stage;
+    qint64 usec;
+    qint64 bytes;
+};
+
+// read-only mapping of an encoded image file, copies share the mapping and the
+// file is unmapped with the last copy
+struct magentaMapping {
+    QFile file;
+    uchar *bytes;
+    qint64 length;
+    explicit magentaMapping(QString fileName) : file(fileName), bytes(0), length(0) {}
+    ~magentaMapping() { if (bytes) { file.unmap(bytes); } }
+};
+
+struct magentaSource {
+    QString file;
+    QSharedPointer<magentaMapping> mapping;
+    const char *data() const { return mapping?reinterpret_cast<const char*>(mapping->bytes):0; }
+    qint64 size() const { return mapping?mapping->length:0; }
+    bool isNull() const { return !mapping || !mapping->bytes; }
+};Q_DECLARE_METATYPE(magentaSource)
 
 struct magentaImage {
-    QByteArray data;
+    blackImage source;
+    blackTransform transform;
     QByteArray profile;
     QString error;
     QString warning;
@@ -38,14 +72,34 @@ struct magentaImage {
     int colorspace;
     int width;
     int height;
+    qint64 memory;
+    int generation;
+    QString job;
+    QList<magentaTiming> timings;
+    // previews arrive twice, first a quick low resolution image, then source,
+    // transform and the pyramid levels for the tiled viewer
+    QImage quick;
+    QList<blackImage> levels;
+    // width and height are the full image, source is 1/scale of that for reduced JPEG decodes
+    int scale;
 };Q_DECLARE_METATYPE(magentaImage)
 
+// preview is the longest side in pixels of the quick first preview pass, 0 skips it
+// zoom is the view scale the image is shown at (1 is 100%), 0 when unknown, it decides
+// how far a JPEG may be reduced when decoded for viewing
+// proof says if the monitor profile is part of the preview chain, alternate also
+// sends the transform for the other proof state once the preview is out (job "alternate")
 struct magentaAdjust {
     double brightness;
     double saturation;
     double hue;
     int intent;
     bool black;
+    int preview;
+    double zoom;
+    bool proof;
+    bool alternate;
+    magentaAdjust() : brightness(100), saturation(100), hue(100), intent(0), black(false), preview(0), zoom(0), proof(true), alternate(false) {}
 };Q_DECLARE_METATYPE(magentaAdjust)
 
 class Magenta : public QObject
@@ -58,12 +112,57 @@ public:
     void returnImage(magentaImage result);
 
     public slots:
-    void requestImage(bool isPreview, bool doSave, QString file, QByteArray data, QByteArray inprofile, QByteArray outprofile, QByteArray monitorprofile, magentaAdjust edit);
-    magentaImage readImage(bool isPreview, bool doSave, QString file, QByteArray data, QByteArray inprofile, QByteArray outprofile, QByteArray monitorprofile, magentaAdjust edit);
+    void requestImage(bool isPreview, bool doSave, QString file, magentaSource data, QByteArray inprofile, QByteArray outprofile, QByteArray monitorprofile, magentaAdjust edit);
+    magentaImage readImage(bool isPreview, bool doSave, QString file, magentaSource data, QByteArray inprofile, QByteArray outprofile, QByteArray monitorprofile, magentaAdjust edit, int generation = 0);
+    void releaseImage();
+    int currentGeneration();
+    blackCancel generationCancel(int generation);
+
+public:
+    // stateless helpers, also used by the batch pipeline, Magick errors are thrown
+    static magentaSource mapSource(QString file);
+    static Magick::Image readSource(magentaSource source);
+    static int imageColorspace(Magick::Image &image);
+    static blackImage imageFormat(Magick::Image &image);
+    static blackImage decodePixels(Magick::Image &image);
+    // images ImageMagick converts itself, floating point, with alpha or too large to pack (see BLACK_MAX_BYTES)
+    static bool needsLegacy(Magick::Image &image);
+    // compression and resolution an ImageMagick write of the image would have kept
+    static magentaTiffTags imageTags(Magick::Image &image);
+    static void profileImage(Magick::Image &image, QByteArray inprofile, QByteArray outprofile, magentaAdjust edit);
+    static bool encodeImage(QString file, blackImage output, QByteArray profile, magentaTiffTags tags, QString *error);
+    static void writeImage(Magick::Image &image, QString file);
+    static QString comment();
+    // value quoted and escaped for the JSON the batch mode, bench and timings log write
+    static QString jsonString(QString value);
+    // TIFF output band by band, from a TIFF file (see magentatiff.h) or an image in memory
+    // outprofile may be a device link, it replaces inprofile and embed is written instead
+    static bool streamImage(QString input, QString file, QByteArray inprofile, QByteArray outprofile, magentaAdjust edit, QString *error, QByteArray embed = QByteArray());
+    static bool streamImage(blackImage source, QString file, QList<QByteArray> profiles, magentaAdjust edit, QString *error, magentaTiffTags tags = magentaTiffTags());
 
 private:
     Yellow yellow;
+    Black black;
     QThread t;
+    QAtomicInt latest;
+    blackImage working;
+    int workingDepth;
+    int workingScale;
+    bool workingLegacy;
+    magentaTiffTags workingTags;
+    QSize workingSize;
+    QString workingFile;
+    magentaSource workingSource;
+    QByteArray workingProfile;
+    QList<blackImage> workingLevels;
+    void decodeImage(Magick::Image &image);
+    void loadImage(magentaSource source, int scale, magentaImage *result);
+    blackImage modulateImage(blackImage input, magentaAdjust edit);
+    QList<blackImage> previewLevels(blackImage input, QList<blackImage> levels, blackCancel cancel);
+    blackTransform previewTransform(blackImage source, QByteArray inprofile, QByteArray outprofile, QByteArray monitorprofile, magentaAdjust edit, QByteArray *profile);
+    void saveImage(QString file, blackImage source, QByteArray inprofile, QByteArray outprofile, magentaAdjust edit, magentaImage *result);
+    static bool streamRows(magentaTiff *reader, blackImage source, QString file, QList<QByteArray> profiles, QByteArray embed, magentaAdjust edit, QString *error, magentaTiffTags tags = magentaTiffTags());
+    static void addTiming(magentaImage *result, QString stage, QElapsedTimer *timer, qint64 bytes);
 };
 
 #endif // MAGENTA_H
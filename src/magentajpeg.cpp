@@ -0,0 +1,146 @@
+/*
+* Cyan <https://github.com/olear/cyan>,
+* Copyright (C) 2016 Ole-André Rodlie
+*
+* Cyan is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License version 2 as published
+* by the Free Software Foundation.
+*
+* Cyan is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Cyan.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+*/
+
+#include "magentajpeg.h"
+#include <cstdio>
+#include <csetjmp>
+#include <jpeglib.h>
+
+#define MAGENTA_JPEG_MAX_SCALE 8
+
+struct magentaJpegError {
+    jpeg_error_mgr manager;
+    jmp_buf jump;
+    char message[JMSG_LENGTH_MAX];
+};
+
+static void magentaJpegExit(j_common_ptr info)
+{
+    magentaJpegError *error = reinterpret_cast<magentaJpegError*>(info->err);
+    (*info->err->format_message)(info, error->message);
+    longjmp(error->jump, 1);
+}
+
+static void magentaJpegOutput(j_common_ptr info)
+{
+    // not printed, a decode with warnings is redone by ImageMagick which reports them
+    Q_UNUSED(info)
+}
+
+// kept apart from decode() so no C++ object lives in the frame that longjmp returns to
+static bool magentaJpegRun(jpeg_decompress_struct *info, magentaJpegError *error, const char *data, qint64 size, int scale, blackImage *output, int *width, int *height)
+{
+    if (setjmp(error->jump)) {
+        return false;
+    }
+    jpeg_mem_src(info, reinterpret_cast<unsigned char*>(const_cast<char*>(data)), (unsigned long)size);
+    jpeg_read_header(info, TRUE);
+    if (info->data_precision != 8) {
+        return false;
+    }
+    *width = (int)info->image_width;
+    *height = (int)info->image_height;
+
+    switch (info->jpeg_color_space) {
+    case JCS_GRAYSCALE:
+        info->out_color_space = JCS_GRAYSCALE;
+        output->colorspace = 3;
+        break;
+    case JCS_CMYK:
+    case JCS_YCCK:
+        info->out_color_space = JCS_CMYK;
+        output->colorspace = 2;
+        break;
+    default:
+        info->out_color_space = JCS_RGB;
+        output->colorspace = 1;
+    }
+    info->scale_num = 1;
+    info->scale_denom = scale;
+    jpeg_start_decompress(info);
+
+    output->width = (int)info->output_width;
+    output->height = (int)info->output_height;
+    output->depth = 8;
+    if ((int)info->output_components != output->channels()) {
+        return false;
+    }
+    if (!output->allocate()) {
+        return false;
+    }
+    while (info->output_scanline < info->output_height) {
+        JSAMPROW row = reinterpret_cast<JSAMPROW>(output->pixels.data()+(qint64)info->output_scanline*output->bytesPerLine());
+        jpeg_read_scanlines(info, &row, 1);
+    }
+    jpeg_finish_decompress(info);
+    return true;
+}
+
+bool magentaJpeg::isJpeg(const char *data, qint64 size)
+{
+    const uchar *bytes = reinterpret_cast<const uchar*>(data);
+    return data && size > 3 && bytes[0] == 0xff && bytes[1] == 0xd8 && bytes[2] == 0xff;
+}
+
+int magentaJpeg::scaleFor(double zoom)
+{
+    if (zoom <= 0) {
+        return 1;
+    }
+    int scale = MAGENTA_JPEG_MAX_SCALE;
+    while (scale > 1 && zoom*scale > 1.0) {
+        scale /= 2;
+    }
+    return scale;
+}
+
+blackImage magentaJpeg::decode(const char *data, qint64 size, int scale, int *width, int *height, QString *error)
+{
+    blackImage output;
+    if (!isJpeg(data, size)) {
+        return output;
+    }
+    jpeg_decompress_struct info;
+    magentaJpegError handler;
+    handler.message[0] = 0;
+    info.err = jpeg_std_error(&handler.manager);
+    handler.manager.error_exit = magentaJpegExit;
+    handler.manager.output_message = magentaJpegOutput;
+    jpeg_create_decompress(&info);
+
+    bool ok = magentaJpegRun(&info, &handler, data, size, qBound(1, scale, MAGENTA_JPEG_MAX_SCALE), &output, width, height);
+    if (handler.manager.num_warnings > 0) {
+        ok = false;
+    }
+    jpeg_destroy_decompress(&info);
+    if (!ok) {
+        if (error && handler.message[0]) {
+            error->append(QString::fromLatin1(handler.message));
+        }
+        return blackImage();
+    }
+
+    // Adobe writes inverted CMYK, ImageMagick inverts every CMYK JPEG on read
+    if (output.colorspace == 2) {
+        uchar *pixels = reinterpret_cast<uchar*>(output.pixels.data());
+        qint64 count = output.pixels.size();
+        for (qint64 i = 0; i < count; ++i) {
+            pixels[i] = 255-pixels[i];
+        }
+    }
+    return output;
+}
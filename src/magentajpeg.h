@@ -0,0 +1,42 @@
+/*
+* Cyan <https://github.com/olear/cyan>,
+* Copyright (C) 2016 Ole-André Rodlie
+*
+* Cyan is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License version 2 as published
+* by the Free Software Foundation.
+*
+* Cyan is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Cyan.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+*/
+
+#ifndef MAGENTAJPEG_H
+#define MAGENTAJPEG_H
+
+#include <QString>
+
+#include "black.h"
+
+// Reduced size JPEG decoding through libjpeg's scaled IDCT (1/2, 1/4 or 1/8),
+// only the coefficients needed for the smaller image are computed.
+//
+// Used for previews when the view is zoomed out far enough, the full image is
+// still decoded by ImageMagick for 100% view and saving. 8-bit RGB (YCbCr),
+// gray and CMYK (YCCK) are supported, CMYK is inverted the same way the
+// ImageMagick JPEG coder does so both decodes agree.
+
+class magentaJpeg
+{
+public:
+    static bool isJpeg(const char *data, qint64 size);
+    // largest supported reduction that still has at least one pixel per view pixel, 1 means full size
+    static int scaleFor(double zoom);
+    static blackImage decode(const char *data, qint64 size, int scale, int *width, int *height, QString *error);
+};
+
+#endif // MAGENTAJPEG_H
@@ -0,0 +1,273 @@
+/*
+* Cyan <https://github.com/olear/cyan>,
+* Copyright (C) 2016 Ole-André Rodlie
+*
+* Cyan is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License version 2 as published
+* by the Free Software Foundation.
+*
+* Cyan is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Cyan.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+*/
+
+#include "magentaprobe.h"
+#include "magenta.h"
+#include <QFile>
+#include <QMap>
+#include <QtEndian>
+#include <cstring>
+
+#define MAGENTA_TIFF_ICC 34675
+
+magentaInfo magentaProbe::probe(const QString &file)
+{
+    magentaInfo info;
+    info.file = file;
+
+    // the mapping only pages in the header bytes that are actually read
+    QFile image(file);
+    if (!image.open(QIODevice::ReadOnly)) {
+        info.error = QObject::tr("Unable to read file");
+        return info;
+    }
+    qint64 size = image.size();
+    uchar *data = size>0?image.map(0, size):0;
+    bool found = false;
+    if (data) {
+        found = probePng(data, size, &info) || probeJpeg(data, size, &info) || probeTiff(data, size, &info);
+        image.unmap(data);
+    }
+    image.close();
+    if (!found || !info.isValid()) {
+        info = magentaInfo();
+        info.file = file;
+        probeMagick(&info);
+    }
+    return info;
+}
+
+bool magentaProbe::probePng(const uchar *data, qint64 size, magentaInfo *info)
+{
+    static const uchar signature[8] = { 0x89, 'P', 'N', 'G', 0x0d, 0x0a, 0x1a, 0x0a };
+    if (size < 8 || std::memcmp(data, signature, 8) != 0) {
+        return false;
+    }
+    info->format = "PNG";
+    bool header = false;
+    qint64 pos = 8;
+    while (pos+12 <= size) {
+        qint64 length = qFromBigEndian<quint32>(data+pos);
+        const char *type = reinterpret_cast<const char*>(data+pos+4);
+        const uchar *body = data+pos+8;
+        if (length > size-pos-12) {
+            break;
+        }
+        if (std::memcmp(type, "IHDR", 4) == 0 && length >= 13) {
+            info->width = (int)qFromBigEndian<quint32>(body);
+            info->height = (int)qFromBigEndian<quint32>(body+4);
+            int bits = body[8];
+            int colorType = body[9];
+            info->colorspace = (colorType==0 || colorType==4)?3:1;
+            info->depth = colorType==3?8:bits;
+            header = true;
+        } else if (std::memcmp(type, "iCCP", 4) == 0) {
+            // name, 0, compression method, zlib stream
+            qint64 name = 0;
+            while (name < length && body[name] != 0) {
+                name++;
+            }
+            if (name+2 < length) {
+                // qUncompress wants the expected size up front and grows its buffer when it is too small
+                QByteArray compressed;
+                quint32 expected = (quint32)qMin<qint64>((length-name-2)*4, 64*1024*1024);
+                compressed.resize(4);
+                qToBigEndian<quint32>(expected, reinterpret_cast<uchar*>(compressed.data()));
+                compressed.append(reinterpret_cast<const char*>(body+name+2), (int)(length-name-2));
+                info->profile = qUncompress(compressed);
+            }
+        } else if (std::memcmp(type, "IDAT", 4) == 0 || std::memcmp(type, "IEND", 4) == 0) {
+            break;
+        }
+        pos += length+12;
+    }
+    return header;
+}
+
+bool magentaProbe::probeJpeg(const uchar *data, qint64 size, magentaInfo *info)
+{
+    if (size < 4 || data[0] != 0xff || data[1] != 0xd8) {
+        return false;
+    }
+    info->format = "JPEG";
+    bool header = false;
+    QMap<int, QByteArray> chunks;
+    qint64 pos = 2;
+    while (pos+4 <= size) {
+        if (data[pos] != 0xff) {
+            break;
+        }
+        int marker = data[pos+1];
+        if (marker == 0xff) {
+            pos++;
+            continue;
+        }
+        if (marker == 0x01 || (marker >= 0xd0 && marker <= 0xd8)) {
+            pos += 2;
+            continue;
+        }
+        if (marker == 0xd9 || marker == 0xda) {
+            break;
+        }
+        qint64 length = qFromBigEndian<quint16>(data+pos+2);
+        if (length < 2 || pos+2+length > size) {
+            break;
+        }
+        const uchar *body = data+pos+4;
+        qint64 bodyLength = length-2;
+        if (marker == 0xe2 && bodyLength > 14 && std::memcmp(body, "ICC_PROFILE\0", 12) == 0) {
+            chunks.insert(body[12], QByteArray(reinterpret_cast<const char*>(body+14), (int)(bodyLength-14)));
+        } else if (marker >= 0xc0 && marker <= 0xcf && marker != 0xc4 && marker != 0xc8 && marker != 0xcc && bodyLength >= 6) {
+            info->depth = body[0];
+            info->height = qFromBigEndian<quint16>(body+1);
+            info->width = qFromBigEndian<quint16>(body+3);
+            switch (body[5]) {
+            case 1:
+                info->colorspace = 3;
+                break;
+            case 3:
+                info->colorspace = 1;
+                break;
+            case 4:
+                info->colorspace = 2;
+                break;
+            }
+            header = true;
+        }
+        pos += 2+length;
+    }
+    QMap<int, QByteArray>::const_iterator chunk = chunks.constBegin();
+    while (chunk != chunks.constEnd()) {
+        info->profile.append(chunk.value());
+        ++chunk;
+    }
+    return header;
+}
+
+bool magentaProbe::probeTiff(const uchar *data, qint64 size, magentaInfo *info)
+{
+    if (size < 8) {
+        return false;
+    }
+    bool little = data[0] == 'I' && data[1] == 'I';
+    bool big = data[0] == 'M' && data[1] == 'M';
+    if (!little && !big) {
+        return false;
+    }
+    // classic TIFF only, BigTIFF (43) is left to ImageMagick
+#define MAGENTA_TIFF16(p) (little?qFromLittleEndian<quint16>(p):qFromBigEndian<quint16>(p))
+#define MAGENTA_TIFF32(p) (little?qFromLittleEndian<quint32>(p):qFromBigEndian<quint32>(p))
+    if (MAGENTA_TIFF16(data+2) != 42) {
+        return false;
+    }
+    info->format = "TIFF";
+    qint64 ifd = MAGENTA_TIFF32(data+4);
+    if (ifd < 8 || ifd+2 > size) {
+        return false;
+    }
+
+    int photometric = -1;
+    int inkset = 1;
+    int entries = MAGENTA_TIFF16(data+ifd);
+    for (int i = 0; i < entries; ++i) {
+        const uchar *entry = data+ifd+2+i*12;
+        if (entry+12 > data+size) {
+            break;
+        }
+        int tag = MAGENTA_TIFF16(entry);
+        int type = MAGENTA_TIFF16(entry+2);
+        qint64 count = MAGENTA_TIFF32(entry+4);
+        // SHORT (3) and LONG (4) values that fit are stored in the entry itself
+        int value = type==3?MAGENTA_TIFF16(entry+8):(int)MAGENTA_TIFF32(entry+8);
+        switch (tag) {
+        case 256:
+            info->width = value;
+            break;
+        case 257:
+            info->height = value;
+            break;
+        case 258:
+            if (count*2 > 4) {
+                qint64 offset = MAGENTA_TIFF32(entry+8);
+                value = offset+2 <= size?MAGENTA_TIFF16(data+offset):0;
+            }
+            info->depth = value;
+            break;
+        case 262:
+            photometric = value;
+            break;
+        case 332:
+            inkset = value;
+            break;
+        case MAGENTA_TIFF_ICC:
+            if (count > 0 && count <= 4) {
+                info->profile = QByteArray(reinterpret_cast<const char*>(entry+8), (int)count);
+            } else if (count > 4) {
+                qint64 offset = MAGENTA_TIFF32(entry+8);
+                if (offset+count <= size) {
+                    info->profile = QByteArray(reinterpret_cast<const char*>(data+offset), (int)count);
+                }
+            }
+            break;
+        }
+    }
+#undef MAGENTA_TIFF16
+#undef MAGENTA_TIFF32
+
+    switch (photometric) {
+    case 0:
+    case 1:
+        info->colorspace = 3;
+        break;
+    case 2:
+    case 3:
+    case 6:
+        info->colorspace = 1;
+        break;
+    case 5:
+        info->colorspace = inkset==1?2:0;
+        break;
+    }
+    if (info->depth == 0) {
+        info->depth = 1;
+    }
+    return info->width > 0 && info->height > 0;
+}
+
+void magentaProbe::probeMagick(magentaInfo *info)
+{
+    Magick::Image image;
+    try {
+        image.ping(info->file.toUtf8().data());
+    }
+    catch(Magick::Error &error_ ) {
+        info->error.append(error_.what());
+        return;
+    }
+    catch(Magick::Warning &warn_ ) {
+        Q_UNUSED(warn_)
+    }
+    info->format = QString::fromStdString(image.magick());
+    info->width = (int)image.columns();
+    info->height = (int)image.rows();
+    info->depth = (int)image.depth();
+    info->colorspace = Magenta::imageColorspace(image);
+    info->profile = QByteArray((char*)image.iccColorProfile().data(), image.iccColorProfile().length());
+    if (info->colorspace == 0) {
+        info->error = QObject::tr("Unsupported image colorspace");
+    }
+}
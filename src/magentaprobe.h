@@ -0,0 +1,56 @@
+/*
+* Cyan <https://github.com/olear/cyan>,
+* Copyright (C) 2016 Ole-André Rodlie
+*
+* Cyan is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License version 2 as published
+* by the Free Software Foundation.
+*
+* Cyan is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Cyan.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+*/
+
+#ifndef MAGENTAPROBE_H
+#define MAGENTAPROBE_H
+
+#include <QString>
+#include <QByteArray>
+
+// size, depth, colorspace (same values as Yellow) and embedded ICC profile of an image file
+struct magentaInfo {
+    QString file;
+    QString format;
+    int width;
+    int height;
+    int depth;
+    int colorspace;
+    QByteArray profile;
+    QString error;
+    magentaInfo() : width(0), height(0), depth(0), colorspace(0) {}
+    bool isValid() const { return error.isEmpty() && width > 0 && height > 0 && colorspace > 0; }
+};
+
+// Reads image information from the file headers only, no pixels are decoded.
+//
+// PNG: IHDR and iCCP chunks up to the first IDAT.
+// JPEG: SOFn and the APP2 ICC_PROFILE segments (joined in sequence order) up to SOS.
+// TIFF: the first IFD, photometric/ink set and tag 34675 (ICC profile).
+// Anything else (or a header these do not understand) is pinged by ImageMagick,
+// which also skips the pixels for most formats.
+
+class magentaProbe
+{
+public:
+    static magentaInfo probe(const QString &file);
+    static bool probePng(const uchar *data, qint64 size, magentaInfo *info);
+    static bool probeJpeg(const uchar *data, qint64 size, magentaInfo *info);
+    static bool probeTiff(const uchar *data, qint64 size, magentaInfo *info);
+    static void probeMagick(magentaInfo *info);
+};
+
+#endif // MAGENTAPROBE_H
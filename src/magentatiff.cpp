@@ -0,0 +1,336 @@
+/*
+* Cyan <https://github.com/olear/cyan>,
+* Copyright (C) 2016 Ole-André Rodlie
+*
+* Cyan is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License version 2 as published
+* by the Free Software Foundation.
+*
+* Cyan is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Cyan.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+*/
+
+#include "magentatiff.h"
+#include <QFile>
+#include <cstring>
+
+static TIFF *magentaTiffOpen(QString file, const char *mode)
+{
+#ifdef Q_OS_WIN
+    return TIFFOpenW(reinterpret_cast<const wchar_t*>(file.utf16()), mode);
+#else
+    return TIFFOpen(file.toLocal8Bit().constData(), mode);
+#endif
+}
+
+static quint16 magentaTiffCompression(quint16 compression)
+{
+    // lossless codecs are kept, anything else would change the pixels or may not be built in
+    switch (compression) {
+    case COMPRESSION_NONE:
+    case COMPRESSION_LZW:
+    case COMPRESSION_ADOBE_DEFLATE:
+    case COMPRESSION_PACKBITS:
+        break;
+    case COMPRESSION_DEFLATE:
+        compression = COMPRESSION_ADOBE_DEFLATE;
+        break;
+    default:
+        compression = COMPRESSION_LZW;
+    }
+    if (!TIFFIsCODECConfigured(compression)) {
+        compression = COMPRESSION_NONE;
+    }
+    return compression;
+}
+
+magentaTiff::magentaTiff() :
+    tif(0)
+    , writing(false)
+    , tiled(false)
+    , row(0)
+    , tileWidth(0)
+    , tileLength(0)
+    , tileStart(-1)
+{
+}
+
+magentaTiff::~magentaTiff()
+{
+    close();
+}
+
+bool magentaTiff::openRead(QString file)
+{
+    close();
+    tif = magentaTiffOpen(file, "r");
+    if (!tif) {
+        return false;
+    }
+
+    quint32 width = 0, height = 0;
+    quint16 bits = 0, samples = 1, format = SAMPLEFORMAT_UINT, planar = PLANARCONFIG_CONTIG, photometric = 0, inkset = INKSET_CMYK;
+    quint16 extraCount = 0;
+    quint16 *extra = 0;
+    TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &width);
+    TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &height);
+    TIFFGetFieldDefaulted(tif, TIFFTAG_BITSPERSAMPLE, &bits);
+    TIFFGetFieldDefaulted(tif, TIFFTAG_SAMPLESPERPIXEL, &samples);
+    TIFFGetFieldDefaulted(tif, TIFFTAG_SAMPLEFORMAT, &format);
+    TIFFGetFieldDefaulted(tif, TIFFTAG_PLANARCONFIG, &planar);
+    TIFFGetFieldDefaulted(tif, TIFFTAG_EXTRASAMPLES, &extraCount, &extra);
+    TIFFGetFieldDefaulted(tif, TIFFTAG_INKSET, &inkset);
+    if (!TIFFGetField(tif, TIFFTAG_PHOTOMETRIC, &photometric)) {
+        close();
+        return false;
+    }
+
+    switch (photometric) {
+    case PHOTOMETRIC_RGB:
+        header.colorspace = 1;
+        break;
+    case PHOTOMETRIC_SEPARATED:
+        header.colorspace = inkset==INKSET_CMYK?2:0;
+        break;
+    case PHOTOMETRIC_MINISBLACK:
+        header.colorspace = 3;
+        break;
+    default:
+        header.colorspace = 0;
+    }
+    header.width = (int)width;
+    header.height = (int)height;
+    header.depth = bits;
+    if (header.colorspace == 0 || width < 1 || height < 1
+            || (bits != 8 && bits != 16) || format != SAMPLEFORMAT_UINT
+            || planar != PLANARCONFIG_CONTIG || extraCount > 0
+            || samples != header.channels()) {
+        close();
+        return false;
+    }
+
+    quint32 profileLength = 0;
+    void *profileData = 0;
+    if (TIFFGetField(tif, TIFFTAG_ICCPROFILE, &profileLength, &profileData) && profileData && profileLength > 0) {
+        iccProfile = QByteArray(reinterpret_cast<const char*>(profileData), (int)profileLength);
+    }
+
+    TIFFGetFieldDefaulted(tif, TIFFTAG_COMPRESSION, &fileTags.compression);
+    if (fileTags.compression == COMPRESSION_LZW || fileTags.compression == COMPRESSION_ADOBE_DEFLATE || fileTags.compression == COMPRESSION_DEFLATE) {
+        TIFFGetFieldDefaulted(tif, TIFFTAG_PREDICTOR, &fileTags.predictor);
+    }
+    float xres = 0, yres = 0;
+    if (TIFFGetField(tif, TIFFTAG_XRESOLUTION, &xres) && TIFFGetField(tif, TIFFTAG_YRESOLUTION, &yres) && xres > 0 && yres > 0) {
+        fileTags.xResolution = xres;
+        fileTags.yResolution = yres;
+        TIFFGetFieldDefaulted(tif, TIFFTAG_RESOLUTIONUNIT, &fileTags.resolutionUnit);
+    }
+
+    tiled = TIFFIsTiled(tif);
+    if (tiled) {
+        quint32 tw = 0, tl = 0;
+        TIFFGetField(tif, TIFFTAG_TILEWIDTH, &tw);
+        TIFFGetField(tif, TIFFTAG_TILELENGTH, &tl);
+        if (tw < 1 || tl < 1) {
+            close();
+            return false;
+        }
+        tileWidth = (int)tw;
+        tileLength = (int)tl;
+        if ((qint64)TIFFTileSize(tif) > BLACK_MAX_BYTES || header.bytesPerLine()*tileLength > BLACK_MAX_BYTES) {
+            close();
+            return false;
+        }
+        tileBuffer.resize((int)TIFFTileSize(tif));
+        tileRows.resize((int)(header.bytesPerLine()*tileLength));
+    }
+    return true;
+}
+
+bool magentaTiff::openWrite(QString file, blackImage format, QByteArray profile, QString comment, magentaTiffTags tags)
+{
+    close();
+    if (format.width < 1 || format.height < 1 || format.colorspace < 1 || format.colorspace > 3 || (format.depth != 8 && format.depth != 16)) {
+        return false;
+    }
+    fileTags = tags;
+    fileTags.compression = magentaTiffCompression(tags.compression);
+    if (fileTags.compression != COMPRESSION_LZW && fileTags.compression != COMPRESSION_ADOBE_DEFLATE) {
+        fileTags.predictor = PREDICTOR_NONE;
+    } else if (fileTags.predictor != PREDICTOR_HORIZONTAL) {
+        fileTags.predictor = PREDICTOR_NONE;
+    }
+
+    // codecs may grow data that does not compress, LZW by up to a half
+    qint64 bytes = format.byteCount()+profile.length()+comment.length();
+    if (fileTags.compression != COMPRESSION_NONE) {
+        bytes += bytes/2;
+    }
+    tif = magentaTiffOpen(file, bytes > MAGENTA_TIFF_CLASSIC?"w8":"w");
+    if (!tif) {
+        return false;
+    }
+    writing = true;
+    header = format;
+    header.pixels.clear();
+    iccProfile = profile;
+
+    quint16 photometric = PHOTOMETRIC_RGB;
+    if (header.colorspace == 2) {
+        photometric = PHOTOMETRIC_SEPARATED;
+    } else if (header.colorspace == 3) {
+        photometric = PHOTOMETRIC_MINISBLACK;
+    }
+    TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, (quint32)header.width);
+    TIFFSetField(tif, TIFFTAG_IMAGELENGTH, (quint32)header.height);
+    TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, (quint16)header.depth);
+    TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, (quint16)header.channels());
+    TIFFSetField(tif, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_UINT);
+    TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, photometric);
+    if (header.colorspace == 2) {
+        TIFFSetField(tif, TIFFTAG_INKSET, INKSET_CMYK);
+    }
+    TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+    TIFFSetField(tif, TIFFTAG_COMPRESSION, fileTags.compression);
+    if (fileTags.predictor != PREDICTOR_NONE) {
+        TIFFSetField(tif, TIFFTAG_PREDICTOR, fileTags.predictor);
+    }
+    TIFFSetField(tif, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
+    TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, TIFFDefaultStripSize(tif, 0));
+    if (fileTags.xResolution > 0 && fileTags.yResolution > 0) {
+        TIFFSetField(tif, TIFFTAG_XRESOLUTION, fileTags.xResolution);
+        TIFFSetField(tif, TIFFTAG_YRESOLUTION, fileTags.yResolution);
+        TIFFSetField(tif, TIFFTAG_RESOLUTIONUNIT, fileTags.resolutionUnit);
+    }
+    if (fileTags.compression != COMPRESSION_NONE) {
+        scanline.resize((int)header.bytesPerLine());
+    }
+    if (!comment.isEmpty()) {
+        TIFFSetField(tif, TIFFTAG_IMAGEDESCRIPTION, comment.toUtf8().constData());
+    }
+    if (iccProfile.length() > 0) {
+        TIFFSetField(tif, TIFFTAG_ICCPROFILE, (quint32)iccProfile.length(), iccProfile.constData());
+    }
+    return true;
+}
+
+bool magentaTiff::close()
+{
+    // a written file is only complete once every row is in and the directory is flushed
+    bool ok = true;
+    if (tif) {
+        if (writing) {
+            ok = row == header.height && TIFFFlush(tif) == 1;
+        }
+        TIFFClose(tif);
+    }
+    tif = 0;
+    writing = false;
+    tiled = false;
+    header = blackImage();
+    iccProfile.clear();
+    fileTags = magentaTiffTags();
+    row = 0;
+    scanline.clear();
+    tileRows.clear();
+    tileBuffer.clear();
+    tileWidth = 0;
+    tileLength = 0;
+    tileStart = -1;
+    return ok;
+}
+
+bool magentaTiff::readTileRow(int y)
+{
+    int start = (y/tileLength)*tileLength;
+    if (start == tileStart) {
+        return true;
+    }
+    int pixelBytes = header.channels()*(header.depth/8);
+    int lines = qMin(tileLength, header.height-start);
+    for (int x = 0; x < header.width; x += tileWidth) {
+        if (TIFFReadTile(tif, tileBuffer.data(), (quint32)x, (quint32)start, 0, 0) < 0) {
+            tileStart = -1;
+            return false;
+        }
+        int columns = qMin(tileWidth, header.width-x);
+        for (int line = 0; line < lines; ++line) {
+            memcpy(tileRows.data()+(qint64)line*header.bytesPerLine()+(qint64)x*pixelBytes,
+                   tileBuffer.constData()+(qint64)line*tileWidth*pixelBytes,
+                   (size_t)columns*pixelBytes);
+        }
+    }
+    tileStart = start;
+    return true;
+}
+
+bool magentaTiff::readRows(int rows, blackImage *band)
+{
+    if (!tif || writing || !band || row >= header.height) {
+        return false;
+    }
+    rows = qMin(rows, header.height-row);
+    band->width = header.width;
+    band->height = rows;
+    band->colorspace = header.colorspace;
+    band->depth = header.depth;
+    qint64 stride = band->bytesPerLine();
+    if (band->pixels.size() != stride*rows && !band->allocate()) {
+        return false;
+    }
+    for (int y = 0; y < rows; ++y, ++row) {
+        char *dst = band->pixels.data()+(qint64)y*stride;
+        if (tiled) {
+            if (!readTileRow(row)) {
+                return false;
+            }
+            memcpy(dst, tileRows.constData()+(qint64)(row-tileStart)*stride, (size_t)stride);
+        } else if (TIFFReadScanline(tif, dst, (quint32)row, 0) < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool magentaTiff::writeRows(const blackImage &band)
+{
+    if (!tif || !writing || band.width != header.width || band.colorspace != header.colorspace || band.depth != header.depth) {
+        return false;
+    }
+    qint64 stride = band.bytesPerLine();
+    for (int y = 0; y < band.height && row < header.height; ++y, ++row) {
+        // TIFFWriteScanline takes a non-const buffer, it is only modified when compressing
+        // (the predictor works in place) and the band may share the working image
+        char *src = const_cast<char*>(band.pixels.constData())+(qint64)y*stride;
+        if (!scanline.isEmpty()) {
+            memcpy(scanline.data(), src, (size_t)stride);
+            src = scanline.data();
+        }
+        if (TIFFWriteScanline(tif, src, (quint32)row, 0) < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool magentaTiff::canRead(QString file)
+{
+    // check the byte order mark first, libtiff complains on stderr about anything else
+    QFile header(file);
+    if (!header.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    QByteArray magic = header.read(4);
+    header.close();
+    if (magic != QByteArray("II*\0", 4) && magic != QByteArray("MM\0*", 4)
+            && magic != QByteArray("II+\0", 4) && magic != QByteArray("MM\0+", 4)) {
+        return false;
+    }
+    magentaTiff tiff;
+    return tiff.openRead(file);
+}
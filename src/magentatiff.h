@@ -0,0 +1,94 @@
+/*
+* Cyan <https://github.com/olear/cyan>,
+* Copyright (C) 2016 Ole-André Rodlie
+*
+* Cyan is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License version 2 as published
+* by the Free Software Foundation.
+*
+* Cyan is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Cyan.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+*/
+
+#ifndef MAGENTATIFF_H
+#define MAGENTATIFF_H
+
+#include <QString>
+#include <QByteArray>
+#include <tiffio.h>
+
+#include "black.h"
+
+// rows converted and written per step when streaming
+#define MAGENTA_STREAM_ROWS 256
+// larger files are written as BigTIFF, classic TIFF offsets are 32-bit
+#define MAGENTA_TIFF_CLASSIC Q_INT64_C(0xF0000000)
+
+// Sequential scanline access to TIFF files through libtiff, used to save and
+// convert without holding the whole image in memory.
+//
+// Reading handles stripped and tiled files (any compression libtiff decodes)
+// with 8 or 16-bit unsigned contiguous RGB, CMYK or gray samples and no extra
+// channels, anything else is left to ImageMagick. Only the first directory is read.
+//
+// Writing produces contiguous samples with the ICC profile and the comment as
+// image description. Compression and resolution are taken from the tags, lossy
+// or unavailable codecs are replaced by LZW.
+
+// the tags a conversion keeps from its source, libtiff values
+struct magentaTiffTags {
+    quint16 compression;
+    quint16 predictor;
+    float xResolution;
+    float yResolution;
+    quint16 resolutionUnit;
+    magentaTiffTags() : compression(COMPRESSION_NONE), predictor(PREDICTOR_NONE), xResolution(0), yResolution(0), resolutionUnit(RESUNIT_NONE) {}
+};
+
+class magentaTiff
+{
+public:
+    magentaTiff();
+    ~magentaTiff();
+
+    bool openRead(QString file);
+    bool openWrite(QString file, blackImage format, QByteArray profile, QString comment, magentaTiffTags tags = magentaTiffTags());
+    bool close();
+
+    // width, height, colorspace and depth of the open file, no pixels
+    blackImage format() const { return header; }
+    QByteArray profile() const { return iccProfile; }
+    magentaTiffTags tags() const { return fileTags; }
+    int currentRow() const { return row; }
+
+    // next rows top to bottom, a band is resized to hold them
+    bool readRows(int rows, blackImage *band);
+    bool writeRows(const blackImage &band);
+
+    static bool canRead(QString file);
+
+private:
+    TIFF *tif;
+    bool writing;
+    bool tiled;
+    blackImage header;
+    QByteArray iccProfile;
+    magentaTiffTags fileTags;
+    int row;
+    // compressing codecs work in the row buffer they are given
+    QByteArray scanline;
+    // tiled files are decoded one row of tiles at a time
+    QByteArray tileRows;
+    QByteArray tileBuffer;
+    int tileWidth;
+    int tileLength;
+    int tileStart;
+    bool readTileRow(int y);
+};
+
+#endif // MAGENTATIFF_H
@@ -16,10 +16,22 @@
 */
 
 #include "cyan.h"
+#include "cyanbatch.h"
 #include <QApplication>
+#include <QCoreApplication>
 
 int main(int argc, char *argv[])
 {
+    // headless conversion, no window and no display connection
+    if (CyanBatch::isBatch(argc, argv)) {
+        QCoreApplication a(argc, argv);
+        QCoreApplication::setApplicationName("Cyan");
+        QCoreApplication::setOrganizationName("Cyan");
+        QCoreApplication::setApplicationVersion(CYAN_VERSION);
+        CyanBatch batch;
+        return batch.run(a.arguments());
+    }
+
     QApplication a(argc, argv);
     QCoreApplication::setApplicationName("Cyan");
     QCoreApplication::setOrganizationName("Cyan");
@@ -20,6 +20,44 @@
 #include <QDir>
 #include <QFile>
 #include <QSettings>
+#include <QHash>
+#include <QSet>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QtConcurrentMap>
+#include <QDataStream>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QCryptographicHash>
+#if QT_VERSION >= 0x050000
+#include <QStandardPaths>
+#else
+#include <QDesktopServices>
+#endif
+
+#define YELLOW_CATALOG_MAGIC 0x43594943
+#define YELLOW_CATALOG_VERSION 1
+
+// profiles found by the last scan, indexed by colorspace as "file|description"
+static QMutex yellowRegistryMutex;
+static bool yellowRegistryScanned = false;
+static QList<yellowProfile> yellowRegistryProfiles;
+static QHash<int, QStringList> yellowRegistryIndex;
+static QHash<int, QStringList> yellowRegistryLinks;
+static yellowRegistryStats yellowRegistryCounters = { 0, 0, 0 };
+static QString yellowCatalogFile;
+
+static int yellowColorSpace(cmsColorSpaceSignature space)
+{
+    if (space == cmsSigRgbData) {
+        return 1;
+    } else if (space == cmsSigCmykData) {
+        return 2;
+    } else if (space == cmsSigGrayData) {
+        return 3;
+    }
+    return 0;
+}
 
 Yellow::Yellow(QObject *parent) :
     QObject(parent)
@@ -106,32 +144,217 @@ int Yellow::profileColorSpaceFromData(QByteArray data)
 
 QStringList Yellow::genProfiles(int colorspace)
 {
-    QStringList output;
-    QStringList folders;
-    folders << QDir::rootPath() + "/WINDOWS/System32/spool/drivers/color";
-    folders << "/Library/ColorSync/Profiles";
-    folders << QDir::homePath() + "/Library/ColorSync/Profiles";
-    folders << "/usr/share/color/icc";
-    folders << "/usr/local/share/color/icc";
-    folders << QDir::homePath() + "/.color/icc";
+    QMutexLocker lock(&yellowRegistryMutex);
+    if (!yellowRegistryScanned) {
+        yellowRegistryProfiles = scanProfiles(profileFolders(), catalogFile(), &yellowRegistryCounters);
+        yellowRegistryIndex.clear();
+        yellowRegistryLinks.clear();
+        QSet<QString> items;
+        for (int i = 0; i < yellowRegistryProfiles.size(); ++i) {
+            yellowProfile profile = yellowRegistryProfiles.at(i);
+            if (profile.profileClass == cmsSigNamedColorClass) {
+                continue;
+            }
+            QString item = profile.file + "|" + profile.description;
+            if (!items.contains(item)) {
+                items.insert(item);
+                if (profile.profileClass == cmsSigLinkClass) {
+                    yellowRegistryLinks[profile.colorspace] << item;
+                } else {
+                    yellowRegistryIndex[profile.colorspace] << item;
+                }
+            }
+        }
+        yellowRegistryScanned = true;
+    }
+    return yellowRegistryIndex.value(colorspace);
+}
+
+QStringList Yellow::genLinks(int colorspace)
+{
+    genProfiles(colorspace);
+    QMutexLocker lock(&yellowRegistryMutex);
+    return yellowRegistryLinks.value(colorspace);
+}
+
+QList<yellowProfile> Yellow::scanProfiles(QStringList folders, QString catalog, yellowRegistryStats *stats)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    // previous scan results, only files with a new size or mtime are parsed again
+    QHash<QString, yellowProfile> cached;
+    if (!catalog.isEmpty()) {
+        QFile catalogFile(catalog);
+        if (catalogFile.open(QIODevice::ReadOnly)) {
+            QDataStream stream(&catalogFile);
+            quint32 magic, version, count;
+            stream >> magic >> version >> count;
+            if (magic == YELLOW_CATALOG_MAGIC && version == YELLOW_CATALOG_VERSION) {
+                for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+                    yellowProfile profile;
+                    qint32 colorspace, profileClass;
+                    stream >> profile.file >> profile.modified >> profile.size >> profile.hash >> profile.description >> colorspace >> profileClass >> profile.version;
+                    profile.colorspace = colorspace;
+                    profile.profileClass = profileClass;
+                    if (stream.status() == QDataStream::Ok) {
+                        cached.insert(profile.file, profile);
+                    }
+                }
+            }
+            catalogFile.close();
+        }
+    }
+
+    QSet<QString> files;
+    QList<yellowProfile> found;
+    QStringList changed;
     for (int i = 0; i < folders.size(); ++i) {
         QStringList filter;
         filter << "*.icc";
         filter << "*.icm";
         QDirIterator it(folders.at(i), filter, QDir::Files, QDirIterator::Subdirectories);
         while (it.hasNext()) {
-            QString iccFile = it.next();
-            QString profile = profileDescFromFile(iccFile);
-            int profileColor = profileColorSpaceFromFile(iccFile);
-            if (profileColor==colorspace && !profile.isEmpty()) {
-                output << iccFile + "|" + profile;
+            QString file = it.next();
+            if (files.contains(file)) {
+                continue;
             }
+            files.insert(file);
+            QFileInfo info = it.fileInfo();
+            yellowProfile profile = cached.value(file);
+            if (profile.file.isEmpty() || profile.size != info.size() || profile.modified != info.lastModified().toMSecsSinceEpoch()) {
+                changed << file;
+                profile.file.clear();
+            }
+            found << profile;
+        }
+    }
+
+    QList<yellowProfile> parsed = QtConcurrent::blockingMapped<QList<yellowProfile> >(changed, Yellow::profileFromFile);
+    for (int i = 0, p = 0; i < found.size() && p < parsed.size(); ++i) {
+        if (found.at(i).file.isEmpty()) {
+            found[i] = parsed.at(p++);
+        }
+    }
+
+    if (!catalog.isEmpty() && (!changed.isEmpty() || found.size() != cached.size())) {
+        QDir().mkpath(QFileInfo(catalog).absolutePath());
+        QFile catalogFile(catalog + ".tmp");
+        if (catalogFile.open(QIODevice::WriteOnly)) {
+            QDataStream stream(&catalogFile);
+            stream << (quint32)YELLOW_CATALOG_MAGIC << (quint32)YELLOW_CATALOG_VERSION << (quint32)found.size();
+            for (int i = 0; i < found.size(); ++i) {
+                yellowProfile profile = found.at(i);
+                stream << profile.file << profile.modified << profile.size << profile.hash << profile.description << (qint32)profile.colorspace << (qint32)profile.profileClass << profile.version;
+            }
+            catalogFile.close();
+            QFile::remove(catalog);
+            QFile::rename(catalog + ".tmp", catalog);
+        }
+    }
+
+    QList<yellowProfile> output;
+    for (int i = 0; i < found.size(); ++i) {
+        if (found.at(i).colorspace > 0 && !found.at(i).description.isEmpty()) {
+            output << found.at(i);
+        }
+    }
+
+    if (stats) {
+        stats->msec = timer.elapsed();
+        stats->total = found.size();
+        stats->parsed = changed.size();
+    }
+
+    return output;
+}
+
+yellowProfile Yellow::profileFromFile(const QString &file)
+{
+    yellowProfile output;
+    output.file = file;
+    output.colorspace = 0;
+    output.profileClass = 0;
+    output.version = 0;
+    QFileInfo info(file);
+    output.size = info.size();
+    output.modified = info.lastModified().toMSecsSinceEpoch();
+    QFile profileFile(file);
+    if (!profileFile.open(QIODevice::ReadOnly)) {
+        return output;
+    }
+    QByteArray data = profileFile.readAll();
+    profileFile.close();
+    output.hash = QCryptographicHash::hash(data, QCryptographicHash::Md5);
+    cmsHPROFILE lcmsProfile = cmsOpenProfileFromMem(data.data(), data.length());
+    if (lcmsProfile) {
+        char buffer[500];
+        if (cmsGetProfileInfoASCII(lcmsProfile, cmsInfoDescription, "en", "US", buffer, 500) > 0) {
+            output.description = QString::fromUtf8(buffer);
         }
+        output.colorspace = yellowColorSpace(cmsGetColorSpace(lcmsProfile));
+        output.profileClass = cmsGetDeviceClass(lcmsProfile);
+        output.version = cmsGetProfileVersion(lcmsProfile);
+        cmsCloseProfile(lcmsProfile);
     }
-    output.removeDuplicates();
     return output;
 }
 
+QStringList Yellow::profileFolders()
+{
+    QStringList folders;
+    folders << QDir::rootPath() + "/WINDOWS/System32/spool/drivers/color";
+    folders << "/Library/ColorSync/Profiles";
+    folders << QDir::homePath() + "/Library/ColorSync/Profiles";
+    folders << "/usr/share/color/icc";
+    folders << "/usr/local/share/color/icc";
+    folders << QDir::homePath() + "/.color/icc";
+    return folders;
+}
+
+QString Yellow::catalogFile()
+{
+    if (!yellowCatalogFile.isEmpty()) {
+        return yellowCatalogFile;
+    }
+#if QT_VERSION >= 0x050000
+    QString folder = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+#else
+    QString folder = QDesktopServices::storageLocation(QDesktopServices::CacheLocation);
+#endif
+    if (folder.isEmpty()) {
+        return QString();
+    }
+    return folder + "/profiles.catalog";
+}
+
+void Yellow::setCatalogFile(QString file)
+{
+    QMutexLocker lock(&yellowRegistryMutex);
+    yellowCatalogFile = file;
+}
+
+QList<yellowProfile> Yellow::registry()
+{
+    QMutexLocker lock(&yellowRegistryMutex);
+    return yellowRegistryProfiles;
+}
+
+yellowRegistryStats Yellow::registryStats()
+{
+    QMutexLocker lock(&yellowRegistryMutex);
+    return yellowRegistryCounters;
+}
+
+void Yellow::clearRegistry()
+{
+    QMutexLocker lock(&yellowRegistryMutex);
+    yellowRegistryScanned = false;
+    yellowRegistryProfiles.clear();
+    yellowRegistryIndex.clear();
+    yellowRegistryLinks.clear();
+}
+
 QByteArray Yellow::profileDefault(int colorspace)
 {
     QByteArray bytes;
@@ -22,6 +22,25 @@
 #include <lcms2.h>
 #include <QStringList>
 #include <QByteArray>
+#include <QList>
+
+struct yellowProfile {
+    QString file;
+    QString description;
+    QByteArray hash;
+    int colorspace;
+    int profileClass;
+    double version;
+    qint64 size;
+    qint64 modified;
+};
+
+// the last profile scan, parsed counts the files the catalog could not vouch for
+struct yellowRegistryStats {
+    qint64 msec;
+    int total;
+    int parsed;
+};
 
 class Yellow : public QObject
 {
@@ -37,6 +56,20 @@ public slots:
     int profileColorSpaceFromFile(QString file);
     int profileColorSpaceFromData(QByteArray data);
     QStringList genProfiles(int colorspace);
+    // device links taking colorspace as input, "file|description" like genProfiles
+    QStringList genLinks(int colorspace);
+    // stats gets the scan time and how many files had to be parsed (not in the catalog or changed)
+    QList<yellowProfile> scanProfiles(QStringList folders, QString catalog, yellowRegistryStats *stats = 0);
+
+public:
+    static yellowProfile profileFromFile(const QString &file);
+    static QStringList profileFolders();
+    static QString catalogFile();
+    // use another catalog than the one in the cache folder, set before the first scan
+    static void setCatalogFile(QString file);
+    static QList<yellowProfile> registry();
+    static yellowRegistryStats registryStats();
+    static void clearRegistry();
 };
 
 #endif // YELLOW_H